@@ -0,0 +1,73 @@
+#ifndef CLUSTERENGINE_H
+#define CLUSTERENGINE_H
+
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+class ClusterList;
+struct Cluster;
+struct Packet;
+
+// Finished clusters that fail any of these are dropped before being encoded, saved or published
+struct ClusterFilters {
+    int min_hits = 1;
+    int min_tot = 0;
+    int max_tot = 0; // 0 disables the upper limit
+    int density_radius = 1; // pixels
+    int density_time = 20; // ToA units
+    int density_min_neighbours = 0; // 0 disables the density requirement
+};
+
+// Clusters a stream of decoded packets. This has no dependency on the server threads, so that the
+// offline tool runs exactly the same code as the live clustering server.
+class ClusterEngine {
+
+public:
+    ClusterEngine();
+    ~ClusterEngine();
+    ClusterEngine(const ClusterEngine &rhs) = delete;
+
+    // the cluster geometry and output format are shared by all engines
+    static void setClusterParameters(int max_separation_xy, int max_separation_t, int max_t_sep);
+    static void setShapeOutput(bool enabled); // each cluster becomes [centroid, shape] instead of [centroid]
+    static std::size_t getWordsPerCluster();
+
+    void setFilters(const ClusterFilters &filters);
+
+    // finished clusters which pass the filters are appended to output
+    void addPackets(const std::uint64_t *data, std::size_t num_packets, std::vector<std::uint64_t> &output);
+    void flush(std::vector<std::uint64_t> &output); // finishes all open clusters
+    // finishes clusters last extended before idle_deadline, or whose ToA lags the last packet by more than stream_lag (0 disables)
+    void flushExpired(std::chrono::steady_clock::time_point idle_deadline, std::int64_t stream_lag, std::vector<std::uint64_t> &output);
+
+    std::size_t getNumOpenClusters() const;
+
+    enum RejectReason {
+        REJECT_TOO_FEW_HITS = 0,
+        REJECT_TOT_TOO_LOW,
+        REJECT_TOT_TOO_HIGH,
+        REJECT_TOO_SPARSE,
+        NUM_REJECT_REASONS
+    };
+
+    // [accepted, rejected for each RejectReason], counted since the filters were last set
+    std::array<std::uint64_t, NUM_REJECT_REASONS + 1> getFilterStatistics() const;
+
+private:
+    void finishCluster(const Cluster &cluster, std::vector<std::uint64_t> &output);
+    bool isDensityCore(const Packet &click);
+
+    std::unique_ptr<ClusterList> mOpenClusters { nullptr };
+    std::int64_t mLastToA {0};
+
+    ClusterFilters mFilters {};
+    std::vector<std::int64_t> mLastHitToA {}; // most recent ToA seen on each pixel, for the density filter
+    std::uint64_t mAcceptedClusters {0};
+    std::array<std::uint64_t, NUM_REJECT_REASONS> mRejectedClusters {};
+
+};
+
+#endif // CLUSTERENGINE_H
@@ -0,0 +1,50 @@
+#ifndef CLUSTERFILEWRITER_H
+#define CLUSTERFILEWRITER_H
+
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <utility>
+#include <vector>
+
+// Writes cluster files with the following layout (all words big-endian):
+//      "CLUSTERS"                          8 bytes
+//      number of clusters                  8 bytes ( written when the file is closed )
+//      cluster data                        words_per_cluster x 8 bytes per cluster
+//      time index                          16 bytes per entry: [first ToA in interval, byte offset of that cluster]
+//      number of index entries             8 bytes
+//      index interval (ToA units)          8 bytes
+//      words per cluster                   8 bytes
+//      "CLUSTIDX"                          8 bytes
+// A reader can take the last 32 bytes as the footer and seek straight to the index.
+class ClusterFileWriter {
+
+public:
+    ClusterFileWriter() = default;
+    ~ClusterFileWriter();
+    ClusterFileWriter(const ClusterFileWriter &rhs) = delete;
+
+    bool open(const std::string &path, std::size_t words_per_cluster);
+    void close(); // flushes the data, then writes the index and the final cluster count
+
+    bool isOpen() const;
+    std::size_t getWordsPerCluster() const;
+    std::uint64_t getNumClusters() const;
+
+    void write(const std::uint64_t *data, std::size_t num_words);
+
+private:
+    void flushBuffer();
+
+    std::ofstream mFile {};
+    std::vector<std::uint64_t> mBuffer {};
+
+    std::size_t mWordsPerCluster {1};
+    std::uint64_t mNumClusters {0};
+
+    std::vector<std::pair<std::uint64_t, std::uint64_t>> mIndex {};
+    std::uint64_t mNextIndexToA {0};
+
+};
+
+#endif // CLUSTERFILEWRITER_H
@@ -20,6 +20,10 @@ public:
     void setClusterParameters(const DataVec &data);
     void flushClusters(const DataVec &data);
     void setClusterPath(const DataVec &data);
+    void setClusterFlushWatermark(const DataVec &data);
+    void setClusterFilters(const DataVec &data);
+    void sendClusterFilterStats(const DataVec &data);
+    void setClusterOutputFormat(const DataVec &data);
 
 private:
     std::string mRawPacketAddr {};
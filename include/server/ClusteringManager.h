@@ -1,16 +1,17 @@
 #ifndef CLUSTERINGMANAGER_H
 #define CLUSTERINGMANAGER_H
 
+#include <array>
 #include <memory>
 #include <vector>
-#include <fstream>
+#include <chrono>
 
 #include "ClusterThread.h"
+#include "ClusterEngine.h"
+#include "ClusterFileWriter.h"
 
 #include "zmq.hpp"
 
-class ClusterList;
-
 class ClusteringManager {
 
 public:
@@ -20,26 +21,40 @@ public:
     std::string getPublishServerAddress();
     void setRawPacketServerAddress(const std::string &path);
     void setClusterParameters(int max_separation_xy, int max_separation_t, int max_t_sep);
+    void setFlushWatermark(int idle_ms, std::int64_t stream_lag); // 0 disables either deadline
+    void setClusterFilters(const ClusterFilters &filters);
+    bool setShapeOutput(bool enabled); // each cluster becomes [centroid, shape] instead of [centroid]
+
+    // [accepted, rejected for each ClusterEngine::RejectReason], counted since the filters were last set
+    std::array<std::uint64_t, ClusterEngine::NUM_REJECT_REASONS + 1> getFilterStatistics() const;
 
     void poll();
     void flush(); // finishes all open clusters
+    void flushExpired(); // finishes clusters that have passed the idle or stream-time watermark
     void handlePackets(const std::uint64_t *data, std::size_t num_packets);
 
     bool setSaveFile(const std::string &path);
 
 private:
+    void emitClusters(const std::vector<std::uint64_t> &output);
+
     ClusterThread &mThread;
 
     std::unique_ptr<zmq::socket_t> mPublishSocket {nullptr};
     std::unique_ptr<zmq::socket_t> mRawPacketSocket {nullptr};
 
-    std::unique_ptr<ClusterList> mOpenClusters { nullptr };
+    ClusterEngine mEngine {};
 
-    std::ofstream mFile {};
-    std::uint64_t mSavedClusters {0};
+    ClusterFileWriter mWriter {};
 
     int mReceivedChunks {0};
 
+    // clusters that have not been extended for mFlushIdleMs of wall-clock time, or whose ToA lags the
+    // most recently received packet by more than mFlushStreamLag, are emitted without waiting for new hits
+    int mFlushIdleMs {0};
+    std::int64_t mFlushStreamLag {0};
+    std::chrono::steady_clock::time_point mLastWatermarkTick {};
+
 };
 
 #endif // CLUSTERINGMANAGER_H
@@ -70,6 +70,7 @@ public:
     zmq::socket_t* getUdpThreadSocket();
     zmq::socket_t* getClusterThreadSocket();
     zmq::socket_t* getHistogramThreadSocket();
+    zmq::socket_t* getHistogramScanSocket(); // a separate client for the scan engine, which waits on each reply
 
 private:
     CommsSettings mSettings {};
@@ -86,6 +87,7 @@ private:
 
     HistogramThread *mHistogramThread {nullptr};
     std::unique_ptr<zmq::socket_t> mHistogramCommandSocket {nullptr};
+    std::unique_ptr<zmq::socket_t> mHistogramScanSocket {nullptr};
 
     zmq::context_t mZmq {};
 
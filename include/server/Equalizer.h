@@ -0,0 +1,72 @@
+#ifndef EQUALIZER_H
+#define EQUALIZER_H
+
+#include <cstdint>
+#include <vector>
+
+#include "ScanEngine.h"
+
+#include "common_defs.h"
+
+// An equalization runs the same threshold scan twice, with every pixel at trim 0 and then at trim 15, and counts a
+// pixel as past its noise edge at the first scan step where it counted more than noise_counts hits.
+struct EqualizationSettings {
+    ScanSettings scan {};
+    std::uint32_t noise_counts {0};
+
+    static constexpr std::size_t CONFIG_WORDS = ScanSettings::CONFIG_WORDS + 1;
+
+    // words are the threshold scan's ScanSettings words followed by [noise counts]
+    bool fromConfigWords(const DataVec &words);
+};
+
+// Finds the noise edge of every pixel from the images of a scan, one step at a time.
+class NoiseEdgeFinder {
+
+public:
+    static constexpr std::int32_t NO_EDGE = -1;
+
+    explicit NoiseEdgeFinder(std::uint32_t noise_counts);
+
+    void addStep(std::uint32_t value, const DataVec &image); // steps in scan order
+    const std::vector<std::int32_t>& getEdges() const; // the DAC value of each pixel's edge, or NO_EDGE
+
+private:
+    std::uint32_t mNoiseCounts;
+    std::vector<std::int32_t> mEdges;
+
+};
+
+// Computes the trim of each pixel from its noise edges at the two ends of the trim range. The edges are assumed to
+// move linearly with the trim, by the mean shift over all pixels; each pixel gets the trim that brings its edge
+// closest to the mean of all the edges halfway through the trim range. Pixels without both edges are masked.
+class Equalizer {
+
+public:
+    static constexpr std::size_t NUM_PIXELS = 256*256; // pixel p = x + 256*y
+    static constexpr std::uint8_t MAX_TRIM = 15;
+
+    // a pixel's 6 configuration bits: bit 0 masks the pixel, bits 1-4 hold the trim and bit 5 enables test pulses
+    static constexpr std::uint8_t MASK_BIT = 0x01;
+    static constexpr int TRIM_SHIFT = 1;
+
+    static std::uint8_t getPixelConfig(std::uint8_t trim, bool masked);
+
+    // 256 columns of 48 words, as taken by UPLOAD_PIXEL_CONFIG; bit n of a column's bitstream is bit (n % 32) of word
+    // (n / 32), and pixel y of the column holds bits [6*y, 6*y + 6)
+    static DataVec packPixelConfig(const std::vector<std::uint8_t> &pixels);
+
+    void compute(const std::vector<std::int32_t> &edges_trim0, const std::vector<std::int32_t> &edges_trim15);
+
+    const std::vector<std::uint8_t>& getTrims() const;
+    std::size_t getNumMasked() const;
+    DataVec getPixelConfig() const;
+
+private:
+    std::vector<std::uint8_t> mTrims = std::vector<std::uint8_t>(NUM_PIXELS, 0);
+    std::vector<bool> mMasked = std::vector<bool>(NUM_PIXELS, false);
+    std::size_t mNumMasked {0};
+
+};
+
+#endif // EQUALIZER_H
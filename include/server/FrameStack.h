@@ -0,0 +1,46 @@
+#ifndef FRAMESTACK_H
+#define FRAMESTACK_H
+
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <vector>
+
+// Sorts hits into consecutive 256x256 frames by ToA, like a framing camera: frame n holds the hits with
+// n*frame_length <= ToA < (n+1)*frame_length. Hits may arrive out of order by up to the tolerance; a frame is
+// finished once a hit at least tolerance past its end has been seen, and finished frames are handed on in order.
+// Hits for a frame that was already finished are dropped and counted as late.
+class FrameStack {
+
+public:
+    using FrameCallback = std::function<void(std::uint64_t frame_index, const std::vector<std::uint32_t> &counts)>;
+
+    static constexpr std::size_t NUM_PIXELS = 256*256;
+    static constexpr std::uint64_t MAX_OPEN_FRAMES = 1024; // gaps longer than this skip frames rather than send empty ones
+
+    void setFrameLength(std::uint64_t frame_length, std::uint64_t tolerance); // a length of 0 disables the stack; drops open frames
+    bool isEnabled() const;
+    std::uint64_t getFrameLength() const;
+
+    void addPackets(const std::uint64_t *data, std::size_t num_packets, const FrameCallback &callback);
+    void flush(const FrameCallback &callback); // finishes every open frame
+
+    std::uint64_t getNumLateHits() const;
+
+private:
+    void finishFrames(std::uint64_t end_frame, const FrameCallback &callback); // finishes the frames before end_frame
+
+    std::uint64_t mFrameLength {0};
+    std::uint64_t mTolerance {0};
+
+    std::deque<std::vector<std::uint32_t>> mOpenFrames {};
+    std::vector<std::vector<std::uint32_t>> mSpareFrames {}; // finished frames kept for reuse
+    std::uint64_t mFirstOpenFrame {0};
+    std::uint64_t mLatestToA {0};
+    bool mStarted {false};
+
+    std::uint64_t mNumLateHits {0};
+
+};
+
+#endif // FRAMESTACK_H
@@ -0,0 +1,59 @@
+#ifndef HISTOGRAMACCUMULATOR_H
+#define HISTOGRAMACCUMULATOR_H
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+// 256x256 count image of decoded packets, indexed as x + 256*y
+template<typename Counter>
+class HistogramAccumulator {
+
+public:
+    static constexpr std::size_t NUM_PIXELS = 256*256;
+
+    HistogramAccumulator() :
+        mCounts(NUM_PIXELS, 0) {}
+
+    void addPackets(const std::uint64_t *data, std::size_t num_packets) {
+        for(std::size_t ix = 0; ix < num_packets; ++ix) {
+            auto packet = data[ix];
+            auto x = (packet >> 56) & 0xFF;
+            auto y = (packet >> 48) & 0xFF;
+            ++mCounts[x + y*256];
+        }
+    }
+
+    void addToPixel(std::size_t pixel, Counter weight) {
+        mCounts[pixel] += weight;
+    }
+
+    // adds the counts of another (e.g. per-thread) histogram to this one
+    void add(const HistogramAccumulator &other) {
+        for(std::size_t ix = 0; ix < NUM_PIXELS; ++ix)
+            mCounts[ix] += other.mCounts[ix];
+    }
+
+    // adds these counts to a (usually wider) total; kept as a plain loop over contiguous arrays so that it compiles to vector adds
+    template<typename Total>
+    void addTo(std::vector<Total> &total) const {
+        auto *dst = total.data();
+        const auto *src = mCounts.data();
+        for(std::size_t ix = 0; ix < NUM_PIXELS; ++ix)
+            dst[ix] += src[ix];
+    }
+
+    void clear() {
+        std::fill(mCounts.begin(), mCounts.end(), 0);
+    }
+
+    const std::vector<Counter>& getCounts() const {
+        return mCounts;
+    }
+
+private:
+    std::vector<Counter> mCounts;
+
+};
+
+#endif // HISTOGRAMACCUMULATOR_H
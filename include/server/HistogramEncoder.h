@@ -0,0 +1,59 @@
+#ifndef HISTOGRAMENCODER_H
+#define HISTOGRAMENCODER_H
+
+#include <cstdint>
+#include <vector>
+
+enum class HistogramEncoding : std::uint32_t {
+    DENSE = 0,      // every pixel, x + 256*y
+    SPARSE = 1,     // runs of nonzero pixels
+    DELTA = 2       // runs of pixels whose value changed since the previous frame
+};
+
+// Encodes one histogram product per period for publishing. Each frame has a header of HEADER_WORDS 32-bit words:
+//      version, encoding, counter width (bits), sequence number, base sequence number, number of runs, number of values
+// followed by the payload. Dense payloads are one counter per pixel. Sparse and delta payloads are num_runs 32-bit run
+// words ( start pixel | (run length - 1) << 16 ) followed by num_values counters, the values of each run in turn.
+// A delta frame replaces the listed pixels of frame base_sequence; the others are unchanged.
+//
+// In automatic mode each frame uses whichever encoding is smallest, except that a delta is only sent when the
+// previous frame was sent too and a standalone frame (dense or sparse) goes out at least every KEYFRAME_INTERVAL
+// frames, so that a client that joins late or drops a frame can resynchronise.
+class HistogramEncoder {
+
+public:
+    static constexpr std::uint32_t VERSION = 1;
+    static constexpr std::size_t HEADER_WORDS = 7;
+    static constexpr std::uint32_t KEYFRAME_INTERVAL = 16;
+
+    explicit HistogramEncoder(std::size_t num_pixels = 256*256); // at most 65536 pixels, so a run start fits in 16 bits
+
+    void setCounterWidth(int bits);
+    void setAutomatic(bool automatic); // false always sends dense frames
+    void reset(); // the next frame will be standalone
+
+    // counts are clamped to the counter width
+    void encode(const std::vector<std::uint64_t> &counts);
+
+    const std::vector<std::uint32_t>& getHeader() const;
+    const std::vector<std::uint8_t>& getPayload() const;
+
+private:
+    template<typename Counter>
+    void writePayload(HistogramEncoding encoding, std::size_t num_runs, std::size_t num_values);
+
+    int mCounterWidth {16};
+    bool mAutomatic {false};
+
+    std::uint32_t mSequence {0};
+    std::uint32_t mFramesSinceKeyframe {KEYFRAME_INTERVAL};
+
+    std::vector<std::uint64_t> mCurrent {};  // clamped counts of this frame
+    std::vector<std::uint64_t> mPrevious {}; // as last sent, the base of a delta
+
+    std::vector<std::uint32_t> mHeader {};
+    std::vector<std::uint8_t> mPayload {};
+
+};
+
+#endif // HISTOGRAMENCODER_H
@@ -0,0 +1,44 @@
+#ifndef HISTOGRAMINTEGRATOR_H
+#define HISTOGRAMINTEGRATOR_H
+
+#include <cstdint>
+#include <vector>
+
+enum class HistogramMode : std::uint32_t {
+    PER_PERIOD = 0,     // counts of the last output period only
+    CUMULATIVE = 1,     // counts since the last reset
+    SLIDING = 2,        // counts of the last N output periods
+    DECAYING = 3        // each period's counts are added to the previous image scaled by a retention factor
+};
+
+// Turns the counts of each output period into the image that is published for one product
+class HistogramIntegrator {
+
+public:
+    static constexpr std::uint32_t MAX_SLIDING_PERIODS = 64;
+    static constexpr std::uint32_t DECAY_SCALE = 65536;
+
+    HistogramIntegrator();
+
+    // parameter is the number of periods for SLIDING ( 1 to MAX_SLIDING_PERIODS ) and the fraction of the image
+    // kept each period, in units of 1/DECAY_SCALE, for DECAYING; returns false if it is out of range
+    bool setMode(HistogramMode mode, std::uint32_t parameter);
+    void reset();
+
+    // adds the counts of a finished period and returns the image to publish
+    const std::vector<std::uint64_t>& integrate(const std::vector<std::uint64_t> &period_counts);
+    const std::vector<std::uint64_t>& getImage() const;
+
+private:
+    HistogramMode mMode {HistogramMode::PER_PERIOD};
+    std::uint32_t mSlidingPeriods {1};
+    double mRetention {0.0};
+
+    std::vector<std::uint64_t> mImage {};
+    std::vector<std::vector<std::uint32_t>> mRing {}; // SLIDING: counts of the periods in the window, oldest at mRingPos
+    std::size_t mRingPos {0};
+    std::vector<double> mDecayed {};
+
+};
+
+#endif // HISTOGRAMINTEGRATOR_H
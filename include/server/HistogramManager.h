@@ -5,6 +5,18 @@
 #include <vector>
 
 #include "HistogramThread.h"
+#include "FrameStack.h"
+#include "HistogramAccumulator.h"
+#include "HistogramEncoder.h"
+#include "HistogramIntegrator.h"
+#include "HistogramProduct.h"
+#include "HistogramPyramid.h"
+#include "MappedFrameFile.h"
+#include "PacketWorkerPool.h"
+#include "RoiCounter.h"
+#include "TofAccumulator.h"
+#include "TotCube.h"
+#include "VolumeAccumulator.h"
 
 #include "zmq.hpp"
 
@@ -17,19 +29,104 @@ public:
     std::string getPublishServerAddress();
     void setInputServerAddress(const std::string &path);
     void setOutputPeriod(int period_ms);
+    bool setCounterWidth(int bits); // 16, 32 or 64; counts above the maximum are clamped when published
+    void setNumThreads(std::size_t num_threads); // 0 accumulates on the histogram thread itself
+    void setProducts(const std::vector<HistogramProduct> &products); // an empty list restores the single ungated count image
+    void setAutomaticEncoding(bool automatic); // false always publishes dense frames
+    bool setMode(HistogramMode mode, std::uint32_t parameter); // see HistogramIntegrator::setMode
+    void reset(); // discards everything accumulated so far, including the current period
+    const std::vector<std::uint64_t>* getImage(std::size_t product) const; // as last published, nullptr for an unknown product
+    void setTofSettings(const TofSettings &settings);
+    void setPyramidOutput(bool enabled); // also publish the binned levels of every product
+    void setRoiTable(std::shared_ptr<const RoiTable> table); // nullptr or no regions disables the ROI counters
+    void setRoiPeriod(int period_ms);
+    void setVolumeSettings(const VolumeSettings &settings);
+
+    // views of the (x, y, ToF) volume accumulated since it was configured or reset, see VolumeAccumulator
+    bool getVolumeSlice(std::size_t tof_start, std::size_t tof_end, std::vector<std::uint64_t> &output);
+    bool getVolumeProjection(VolumeAccumulator::ProjectionAxis axis, std::vector<std::uint64_t> &output);
+
+    // per-pixel ToT spectra accumulated since they were configured or reset, see TotCube
+    bool setTotCubeBins(std::uint32_t num_bins, std::uint32_t bin_width);
+    bool getTotCubePixels(std::size_t first_pixel, std::size_t num_pixels, std::vector<std::uint32_t> &output);
+    bool saveTotCube(const std::string &path);
+
+    void setFrameStack(std::uint64_t frame_length, std::uint64_t tolerance); // see FrameStack; a length of 0 disables it
+    bool setFrameFile(const std::string &path, std::uint64_t capacity); // an empty path stops writing frames to file; false before SET_FRAME_STACK
+
+    // the scan gate counts the hits of one product between opening and closing it, independently of the output period
+    bool openScanGate(std::size_t product); // false for an unknown product
+    std::uint64_t getScanGateCount();
+    const std::vector<std::uint64_t>& closeScanGate();
+
+    // region of the current image of a product at a pyramid level, see HistogramPyramid::getRegion
+    bool getRegion(std::size_t product, int level, std::size_t x0, std::size_t y0, std::size_t x1, std::size_t y1,
+                   std::vector<std::uint64_t> &output);
 
     void poll();
-    void handlePackets(const std::uint64_t *data, std::size_t num_packets);
+    void handlePackets(std::size_t shard, const std::uint64_t *data, std::size_t num_packets); // called by the workers
 
 private:
+    void publish();
+    void collectPartials(); // reduces the workers' partial images into mHistograms, and the scan gate if it is open
+    void resetAccumulators();
+    void publishTofSpectrum();
+    void publishRoiCounts();
+    void emitFrame(std::uint64_t frame_index, const std::vector<std::uint32_t> &counts);
+
+    static std::string getProductTopic(std::size_t product, int level = 0);
+
     HistogramThread &mThread;
 
     std::unique_ptr<zmq::socket_t> mPublishSocket {nullptr};
     std::unique_ptr<zmq::socket_t> mInputSocket {nullptr};
 
     int mOutputPeriod {1000};
+    int mCounterWidth {16};
+    bool mAutomaticEncoding {false}; // dense unless a client asks for the smallest encoding
+
+    std::unique_ptr<PacketWorkerPool> mWorkers {nullptr};
+    std::vector<HistogramProduct> mProducts {};
+    bool mDefaultProducts {true}; // no products have been set, so only the single ungated count image is filled
+    std::vector<std::vector<HistogramAccumulator<std::uint32_t>>> mPartials {}; // [worker][product]
+    std::vector<std::vector<std::uint64_t>> mHistograms {}; // [product], sum of the partials reduced at the end of each period
+    std::vector<HistogramIntegrator> mIntegrators {}; // [product]
+    std::vector<HistogramPyramid> mPyramids {}; // [product]
+    std::vector<std::vector<HistogramEncoder>> mEncoders {}; // [product][pyramid level]
+    bool mPublishPyramid {false};
+
+    TofSettings mTofSettings {};
+    std::vector<TofAccumulator> mTofPartials {}; // [worker]
+    std::vector<std::uint64_t> mTofSpectrum {};
+    std::vector<std::uint32_t> mTofFrame {};
+    std::uint32_t mTofSequence {0};
+
+    std::shared_ptr<const RoiTable> mRoiTable {nullptr};
+    std::vector<RoiCounter> mRoiPartials {}; // [worker]
+    std::vector<std::uint64_t> mRoiCounts {};
+    std::vector<std::uint32_t> mRoiFrame {};
+    std::uint32_t mRoiSequence {0};
+    int mRoiPeriod {10};
+    std::chrono::high_resolution_clock::time_point mLastRoiTime;
+
+    VolumeAccumulator mVolume {}; // shared by the workers, which count into it atomically
+    std::vector<std::vector<std::uint32_t>> mVolumeIndices {}; // [worker]
+
+    TotCube mTotCube {}; // shared by the workers like the volume
+    std::vector<std::vector<std::uint32_t>> mTotCubeIndices {}; // [worker]
+
+    FrameStack mFrameStack {}; // filled on this thread, as it needs the hits in stream order
+    MappedFrameFile mFrameFile {};
+    HistogramEncoder mFrameEncoder {};
+    std::vector<std::uint64_t> mFrameCounts {};
+    std::vector<std::uint32_t> mFrameHeader {};
+
+    bool mScanGateOpen {false};
+    std::size_t mScanProduct {0};
+    std::vector<std::uint64_t> mScanImage {};
 
-    std::array<std::uint16_t, 256*256> mHistogram;
+    HistogramMode mMode {HistogramMode::PER_PERIOD};
+    std::uint32_t mModeParameter {0};
 
     std::chrono::high_resolution_clock::time_point mLastOutputTime;
 
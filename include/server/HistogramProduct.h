@@ -0,0 +1,72 @@
+#ifndef HISTOGRAMPRODUCT_H
+#define HISTOGRAMPRODUCT_H
+
+#include <cstdint>
+#include <vector>
+
+#include "HistogramAccumulator.h"
+
+// Definition of one image filled by the histogram server. All gates are inclusive of start and exclusive of end.
+//
+// The packet stream carries no trigger packets, so the ToA gate is applied to the phase of each hit relative to a
+// periodic trigger: phase = (ToA - toa_phase) mod toa_period, in ToA units (1.5625 ns). A period of 0 disables it.
+struct HistogramProduct {
+    std::uint64_t toa_period {0};
+    std::uint64_t toa_phase {0};
+    std::uint64_t gate_start {0};
+    std::uint64_t gate_end {0};
+    std::uint16_t tot_min {0};
+    std::uint16_t tot_max {0x400};
+    bool weight_by_tot {false};
+
+    static constexpr std::size_t NUM_CONFIG_WORDS = 8;
+
+    // config words are [flags, period_lo, period_hi, phase_lo, phase_hi, gate_start, gate_end, tot_min | tot_max << 16]
+    // where bit 0 of flags selects ToT weighting; returns false if the words do not describe a valid product
+    bool fromConfigWords(const std::uint32_t *words) {
+        weight_by_tot = words[0] & 1;
+        toa_period = words[1] | (static_cast<std::uint64_t>(words[2]) << 32);
+        toa_phase = words[3] | (static_cast<std::uint64_t>(words[4]) << 32);
+        gate_start = words[5];
+        gate_end = words[6];
+        tot_min = words[7] & 0xFFFF;
+        tot_max = words[7] >> 16;
+
+        if(toa_period != 0 && (gate_start >= gate_end || gate_end > toa_period))
+            return false;
+        return tot_min < tot_max;
+    }
+
+    bool accepts(std::uint64_t toa, std::uint16_t tot) const {
+        if(tot < tot_min || tot >= tot_max)
+            return false;
+        if(toa_period == 0)
+            return true;
+        auto phase = toa >= toa_phase ? (toa - toa_phase) % toa_period
+                                      : toa_period - 1 - (toa_phase - toa - 1) % toa_period;
+        return phase >= gate_start && phase < gate_end;
+    }
+};
+
+// fills one accumulator per product in a single pass over the packets, so each hit is decoded once however many
+// products are requested
+template<typename Counter>
+void fillProducts(const std::vector<HistogramProduct> &products, std::vector<HistogramAccumulator<Counter>> &images,
+                  const std::uint64_t *data, std::size_t num_packets) {
+
+    for(std::size_t ix = 0; ix < num_packets; ++ix) {
+        auto packet = data[ix];
+        auto pixel = ((packet >> 56) & 0xFF) + ((packet >> 48) & 0xFF)*256;
+        auto tot = static_cast<std::uint16_t>((packet >> 38) & 0x3FF);
+        auto toa = packet & 0x3FFFFFFFFF;
+
+        for(std::size_t p = 0; p < products.size(); ++p) {
+            const auto &product = products[p];
+            if(product.accepts(toa, tot))
+                images[p].addToPixel(pixel, product.weight_by_tot ? tot : 1);
+        }
+    }
+
+}
+
+#endif // HISTOGRAMPRODUCT_H
@@ -0,0 +1,32 @@
+#ifndef HISTOGRAMPYRAMID_H
+#define HISTOGRAMPYRAMID_H
+
+#include <array>
+#include <cstdint>
+#include <vector>
+
+// Binned copies of a 256x256 image: level n sums 2^n x 2^n blocks into a (256 >> n) x (256 >> n) image,
+// indexed as x + width*y like the full image (level 0)
+class HistogramPyramid {
+
+public:
+    static constexpr int NUM_LEVELS = 4; // 256, 128, 64 and 32 pixels across
+
+    HistogramPyramid();
+
+    void build(const std::vector<std::uint64_t> &image);
+
+    const std::vector<std::uint64_t>& getLevel(int level) const; // level 1 and up
+    static std::size_t getWidth(int level);
+
+    // copies x0 <= x < x1, y0 <= y < y1 of a level (in that level's pixels, 0 being the image passed to build())
+    // row by row into output; returns false if the region is outside the level
+    bool getRegion(const std::vector<std::uint64_t> &image, int level, std::size_t x0, std::size_t y0,
+                   std::size_t x1, std::size_t y1, std::vector<std::uint64_t> &output) const;
+
+private:
+    std::array<std::vector<std::uint64_t>, NUM_LEVELS> mLevels {}; // mLevels[0] is unused
+
+};
+
+#endif // HISTOGRAMPYRAMID_H
@@ -18,8 +18,32 @@ public:
     void sendHistogramServerPath(const DataVec &data);
     void setHistogramInputServer(const DataVec &data);
     void setHistogramOutputPeriod(const DataVec &data);
+    void setHistogramCounterWidth(const DataVec &data);
+    void setHistogramThreads(const DataVec &data);
+    void setHistogramProducts(const DataVec &data);
+    void setHistogramEncoding(const DataVec &data);
+    void setHistogramMode(const DataVec &data);
+    void resetHistogram(const DataVec &data);
+    void sendHistogramImage(const DataVec &data);
+    void setTofHistogram(const DataVec &data);
+    void setHistogramPyramid(const DataVec &data);
+    void sendHistogramRegion(const DataVec &data);
+    void setRoiRegions(const DataVec &data);
+    void setRoiOutputPeriod(const DataVec &data);
+    void setHistogramVolume(const DataVec &data);
+    void sendVolumeSlice(const DataVec &data);
+    void sendVolumeProjection(const DataVec &data);
+    void setTotCube(const DataVec &data);
+    void sendTotCube(const DataVec &data);
+    void saveTotCube(const DataVec &data);
+    void setFrameStack(const DataVec &data);
+    void setFrameStackFile(const DataVec &data);
+    void setScanGate(const DataVec &data);
+    void sendScanGateCount(const DataVec &data);
 
 private:
+    void sendCounts(const std::vector<std::uint64_t> &counts); // clamped to 32 bits
+
     std::string mInputAddr {};
 
     std::unique_ptr<HistogramManager> mHistogramManager {nullptr};
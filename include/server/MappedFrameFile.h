@@ -0,0 +1,53 @@
+#ifndef MAPPEDFRAMEFILE_H
+#define MAPPEDFRAMEFILE_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#ifdef _WIN32
+#include <windows.h>
+#endif
+
+// Fixed-capacity file of 256x256 frames written through a memory mapping, so that other processes can map the same
+// file and read frames while they are written. All fields are in the native byte order:
+//      "TPXFRAME"                          8 bytes
+//      frame length (ToA units)            8 bytes
+//      capacity (frames)                   8 bytes
+//      frames written                      8 bytes ( updated after each frame )
+//      frames                              8 byte frame index followed by 256*256 4-byte counts, per frame
+// Frames past the capacity are not written.
+class MappedFrameFile {
+
+public:
+    static constexpr std::size_t HEADER_BYTES = 32;
+    static constexpr std::size_t FRAME_BYTES = 8 + 256*256*4;
+
+    MappedFrameFile() = default;
+    ~MappedFrameFile();
+    MappedFrameFile(const MappedFrameFile &rhs) = delete;
+
+    bool open(const std::string &path, std::uint64_t frame_length, std::uint64_t capacity);
+    void close();
+
+    bool isOpen() const;
+    bool isFull() const;
+
+    void write(std::uint64_t frame_index, const std::vector<std::uint32_t> &counts);
+
+private:
+#ifdef _WIN32
+    HANDLE mFile {INVALID_HANDLE_VALUE};
+    HANDLE mMapping {nullptr};
+#else
+    int mFile {-1};
+#endif
+    std::uint8_t *mData {nullptr};
+    std::size_t mSize {0};
+
+    std::uint64_t mCapacity {0};
+    std::uint64_t mNumFrames {0};
+
+};
+
+#endif // MAPPEDFRAMEFILE_H
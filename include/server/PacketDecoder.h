@@ -0,0 +1,35 @@
+#ifndef PACKETDECODER_H
+#define PACKETDECODER_H
+
+#include <cstdint>
+#include <vector>
+
+// Converts raw Timepix3 pixel packets into the format published by the server:
+//      X address:  8 bits
+//      Y address:  8 bits
+//      ToT:       10 bits
+//      ToA:       38 bits  ( Timepix reports 34 bits; the other 4 bits leave room for rollover detection )
+class PacketDecoder {
+
+public:
+    // decodes the pixel hits in raw and appends them to output; other packet types are skipped
+    void decode(const std::uint64_t *raw, std::size_t num_words, std::vector<std::uint64_t> &output);
+
+    // decodes the pixel hits in raw into output (which must have room for num_words) without touching
+    // the rollover state, and returns the number of hits. Independent blocks can be decoded in parallel
+    // and then passed through extendToA() in stream order.
+    static std::size_t decodeHits(const std::uint64_t *raw, std::size_t num_words, std::uint64_t *output);
+
+    // inserts the rollover counter into hits produced by decodeHits()
+    void extendToA(std::uint64_t *hits, std::size_t num_hits);
+
+    void resetRolloverCounter();
+
+private:
+    std::uint8_t mRolloverCounter {0};
+    bool mHalfwayToRollover {false};
+    std::uint64_t mLastToA {0};
+
+};
+
+#endif // PACKETDECODER_H
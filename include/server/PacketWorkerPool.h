@@ -0,0 +1,51 @@
+#ifndef PACKETWORKERPOOL_H
+#define PACKETWORKERPOOL_H
+
+#include <algorithm>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Processes batches of decoded packets on a fixed set of worker threads. Each worker has its own shard
+// index, so that accumulators can keep one partial result per worker and combine them without locking.
+// With zero workers, batches are processed immediately on the calling thread as shard 0.
+class PacketWorkerPool {
+
+public:
+    using Handler = std::function<void(std::size_t shard, const std::uint64_t *data, std::size_t num_packets)>;
+
+    PacketWorkerPool(std::size_t num_workers, Handler handler);
+    ~PacketWorkerPool();
+    PacketWorkerPool(const PacketWorkerPool &rhs) = delete;
+
+    std::size_t getNumShards() const;
+
+    static constexpr std::size_t MAX_QUEUED_BATCHES = 256;
+
+    // a batch that arrives while MAX_QUEUED_BATCHES are already waiting is dropped, so that workers that fall behind
+    // don't grow the queue without limit; returns false if it was dropped
+    bool submit(std::vector<std::uint64_t> &&batch);
+    void drain(); // blocks until every submitted batch has been processed
+    std::uint64_t takeNumDropped(); // the number of batches dropped since the last call
+
+private:
+    void run(std::size_t shard);
+
+    Handler mHandler;
+    std::vector<std::thread> mWorkers {};
+
+    std::mutex mMutex {};
+    std::condition_variable mWorkAvailable {};
+    std::condition_variable mWorkDone {};
+    std::deque<std::vector<std::uint64_t>> mQueue {};
+    std::size_t mBusyWorkers {0};
+    std::uint64_t mNumDropped {0};
+    bool mStopping {false};
+
+};
+
+#endif // PACKETWORKERPOOL_H
@@ -1,7 +1,9 @@
 #ifndef TPXSERVER_PYTHONCONNECTIONMANAGER_H
 #define TPXSERVER_PYTHONCONNECTIONMANAGER_H
 
+#include <deque>
 #include <iomanip>
+#include <map>
 #include <sstream>
 #include <utility>
 
@@ -9,12 +11,24 @@
 
 #include "ServerCodes.h"
 #include "TimepixCodes.h"
+#include "TimepixCommandInfo.h"
 
 #include "common_defs.h"
 
 class CommsThread;
 class TimepixConnectionManager;
 
+// the sub-commands of a BATCH request and the replies collected so far; with stop_on_error set, each sub-command
+// runs only once the one before it has succeeded, and otherwise consecutive Timepix commands are issued together
+struct BatchReply {
+    ClientId client {};
+    bool stop_on_error {false};
+    std::vector<DataVec> commands {}; // each is [command code][data...]
+    std::vector<DataVec> replies {};
+    std::size_t issued {0};
+    std::size_t received {0};
+};
+
 class PythonConnectionManager {
 
 public:
@@ -28,26 +42,67 @@ public:
 
     void handleCommand(zmq::message_t &command);
 
+    // replies go to the client selected here; handleCommand() selects the sender of each request, and replies to
+    // commands that finish later select the client that queued them first
+    void selectClient(const ClientId &client, ServerCommand reply_code);
+    const ClientId& getCurrentClient() const;
+    ServerCommand getCurrentCommand() const;
+
     void sendError(ServerCommand errcode);
     void sendResponse(const DataVec &data);
 
     template<std::size_t sz, TpxCommand cmd>
     void genericForward(const DataVec &data);
 
+    // as genericForward, but answered from the register cache where possible; an extra non-zero word forces a
+    // hardware read
+    template<std::size_t sz, TpxCommand cmd>
+    void cachedForward(const DataVec &data);
+    // a slow-control GET, answered from the telemetry cache while it is fresh; an optional non-zero word asks for the
+    // age of the reading in ms as a second reply word
+    template<TpxCommand cmd>
+    void telemetryForward(const DataVec &data);
+
     void forwardToSecondaryThread(zmq::socket_t *cmd_socket, zmq::message_t &msg);
 
     void sendPixelConfigData(const DataVec &data);
+    void uploadPixelConfig(const DataVec &data);
+    void invalidatePixelConfig(const DataVec &data);
+    void setTelemetryPeriod(const DataVec &data);
+    void executeBatch(const DataVec &data);
+    void runScan(const DataVec &data);
+    void equalize(const DataVec &data);
 
     void bindUdpPort(const DataVec &data);
 
     void setTcpServer(TimepixConnectionManager &tpx_manager);
 
 private:
+    static constexpr std::size_t MAX_BATCH_COMMANDS = 256;
+
+    // a request forwarded to a secondary thread, and the client its reply goes to
+    struct ForwardedRequest {
+        ClientId client {};
+        DataVec message {};
+    };
+
+    void sendToClient(zmq::message_t &payload);
+    void runBatchCommand(const std::shared_ptr<BatchReply> &batch, std::size_t index);
+    void issueBatchCommands(const std::shared_ptr<BatchReply> &batch);
+    void collectBatchReply(zmq::message_t &payload);
+    void pollForwardedRequests();
+    void sendForwardedRequest(zmq::socket_t *cmd_socket);
+    void dropForwardedRequests(zmq::socket_t *cmd_socket, ServerCommand errcode);
 
     CommsThread &mThread;
     TimepixConnectionManager *mTpxManager;
     std::unique_ptr<zmq::socket_t> mCommandSocket {nullptr};
     ServerCommand mLastCommand {ServerCommand::ERROR_OCCURED};
+    ClientId mCurrentClient {};
+
+    // the secondary threads take one request at a time on each command socket, so the others wait their turn here;
+    // the front of each queue has been sent
+    std::map<zmq::socket_t*, std::deque<ForwardedRequest>> mForwardedRequests {};
 
 };
 
@@ -68,4 +123,29 @@ void PythonConnectionManager::genericForward(const DataVec &data) {
     }
 }
 
+template<std::size_t sz, TpxCommand cmd>
+void PythonConnectionManager::cachedForward(const DataVec &data) {
+    if(data.size() == sz + 1) {
+        DataVec request(data.begin(), data.end() - 1);
+        if(data.back() || !mTpxManager->answerFromRegisterCache(this, cmd, request))
+            mTpxManager->queueCommand(this, cmd, std::move(request));
+    } else if(data.size() == sz && mTpxManager->answerFromRegisterCache(this, cmd, data)) {
+        return;
+    } else {
+        genericForward<sz, cmd>(data);
+    }
+}
+
+template<TpxCommand cmd>
+void PythonConnectionManager::telemetryForward(const DataVec &data) {
+    if(data.size() > 1) {
+        genericForward<0, cmd>(data);
+        return;
+    }
+
+    bool with_age = !data.empty() && data[0];
+    if(!mTpxManager->answerFromTelemetry(this, cmd, with_age))
+        mTpxManager->queueCommand(this, cmd, data);
+}
+
 #endif //TPXSERVER_PYTHONCONNECTIONMANAGER_H
@@ -0,0 +1,45 @@
+#ifndef ROICOUNTER_H
+#define ROICOUNTER_H
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+// Regions of interest compiled into a lookup table holding, for every pixel, a bitmask of the regions it belongs to
+struct RoiTable {
+    static constexpr std::size_t MAX_ROIS = 64;
+    static constexpr std::size_t MASK_WORDS = 256*256 / 32;
+
+    enum RegionType : std::uint32_t {
+        RECTANGLE = 0,  // followed by [x0, y0, x1, y1], covering x0 <= x < x1, y0 <= y < y1
+        MASK = 1        // followed by MASK_WORDS words, bit (p % 32) of word (p / 32) set for each pixel p = x + 256*y
+    };
+
+    std::vector<std::uint64_t> masks = std::vector<std::uint64_t>(256*256, 0);
+    std::size_t num_rois {0};
+
+    // words are region definitions one after another; returns false if they can't be parsed or there are too many
+    bool fromConfigWords(const std::uint32_t *words, std::size_t num_words);
+};
+
+// Counts the hits in each region of a table. addPackets() runs on one worker while collectInto() runs on the
+// thread publishing the counts, so they can be read without stopping the worker.
+class RoiCounter {
+
+public:
+    void setTable(std::shared_ptr<const RoiTable> table); // also clears the counts
+
+    void addPackets(const std::uint64_t *data, std::size_t num_packets);
+    void collectInto(std::vector<std::uint64_t> &total); // adds the hits counted since the last call; total must have num_rois entries
+    void clear(); // only while no packets are being added
+
+private:
+    std::shared_ptr<const RoiTable> mTable {nullptr};
+    std::vector<std::uint32_t> mCounts {}; // the current batch, on the worker
+    std::vector<std::atomic<std::uint64_t>> mTotals {}; // everything counted, published after each batch
+    std::vector<std::uint64_t> mCollected {}; // the totals at the last collectInto()
+
+};
+
+#endif // ROICOUNTER_H
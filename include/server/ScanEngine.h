@@ -0,0 +1,95 @@
+#ifndef SCANENGINE_H
+#define SCANENGINE_H
+
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include "asio.hpp"
+#include "zmq.hpp"
+
+#include "ServerCodes.h"
+
+#include "common_defs.h"
+
+class TimepixConnectionManager;
+
+// A DAC scan: the DAC is stepped from first to last (inclusive, in either direction) by step. At each value the
+// scan waits settle_ms, then counts the hits of one histogram product for dwell milliseconds, or until dwell hits
+// have been counted.
+struct ScanSettings {
+    enum class DwellMode : std::uint32_t {
+        TIME = 0,
+        COUNTS = 1
+    };
+
+    std::uint32_t dac_code {0};
+    std::uint32_t first {0};
+    std::uint32_t last {0};
+    std::uint32_t step {1};
+    DwellMode mode {DwellMode::TIME};
+    std::uint32_t dwell {0};
+    std::uint32_t settle_ms {0};
+    std::uint32_t product {0};
+
+    static constexpr std::size_t CONFIG_WORDS = 8;
+    static constexpr std::size_t MAX_STEPS = 256;
+    static constexpr std::size_t MAX_REPLY_STEPS = 32; // RUN_SCAN replies with every image, 256 kB each
+    static constexpr std::uint32_t MAX_DAC_VALUE = 0xFFFF;
+    static constexpr std::uint32_t MAX_DWELL_MS = 60000; // in TIME mode
+
+    // words are [dac code, first, last, step, dwell mode, dwell, settle ms, product]; returns false if they do not
+    // describe a valid scan
+    bool fromConfigWords(const DataVec &words);
+
+    std::vector<std::uint32_t> getValues() const;
+};
+
+// Runs a scan on the connection's io_context: the DAC is set through the normal command path, and the histogram
+// thread's scan gate is opened and closed around each dwell. The DAC is read first and set back to that value at the
+// end. The caller has to keep other commands off the channel while the scan runs.
+//
+// The engine doesn't start or stop readout: it has to be running already, with the histogram thread fed from it. A
+// COUNTS scan that sees no hits for COUNT_STALL_TIMEOUT fails rather than wait out every step, and no scan runs for
+// longer than MAX_SCAN_DURATION.
+class ScanEngine {
+
+public:
+    ScanEngine(TimepixConnectionManager &tpx, zmq::socket_t *histogram_socket, const ScanSettings &settings);
+
+    using StepHandler = std::function<void(std::uint32_t value, const DataVec &image)>;
+
+    // calls on_step with the image of each step as it finishes; returns false if a step failed ( the SPIDR reporting
+    // an error included ), or as soon as should_stop returns true
+    asio::awaitable<bool> run(std::function<bool()> should_stop, StepHandler on_step);
+
+    // result is [number of steps], then [DAC value][image] for each step
+    asio::awaitable<bool> run(std::function<bool()> should_stop, DataVec &result);
+
+    const std::string& getError() const; // why the last run failed
+
+private:
+    static constexpr std::chrono::milliseconds COUNT_POLL_PERIOD {20};
+    static constexpr std::chrono::milliseconds MAX_COUNT_WAIT {10000};
+    static constexpr std::chrono::milliseconds COUNT_STALL_TIMEOUT {2000};
+    static constexpr std::chrono::minutes MAX_SCAN_DURATION {30};
+    static constexpr std::chrono::milliseconds DAC_DEADLINE {1000};
+
+    asio::awaitable<bool> runSteps(const std::function<bool()> &should_stop, const StepHandler &on_step);
+    asio::awaitable<std::optional<std::uint32_t>> readDac();
+    asio::awaitable<bool> setDac(std::uint32_t value);
+    std::optional<DataVec> requestHistogram(ServerCommand cmd, const DataVec &data); // the reply data, without the code
+    asio::awaitable<void> wait(std::chrono::milliseconds duration);
+    asio::awaitable<bool> dwell(const std::function<bool()> &should_stop);
+
+    TimepixConnectionManager &mTpx;
+    zmq::socket_t *mHistogramSocket;
+    ScanSettings mSettings;
+    std::string mError {};
+
+};
+
+#endif // SCANENGINE_H
@@ -68,8 +68,17 @@ enum class ServerCommand : std::uint32_t {
     RESET_MODULE = 41,
     GET_READOUT_SPEED = 42,
 
+    UPLOAD_PIXEL_CONFIG = 43,
+    INVALIDATE_PIXEL_CONFIG = 44,
+
+    SET_TELEMETRY_PERIOD = 45,
+
     SET_SENSEDAC = 48,
 
+    BATCH = 49,
+    RUN_SCAN = 50,
+    EQUALIZE = 51,
+
 // Commands to control the UDP server
     SET_UDP_PORT = 500,
     SET_RAW_TPX3_PATH = 501,
@@ -82,11 +91,37 @@ enum class ServerCommand : std::uint32_t {
     SET_CLUSTER_PARAMETERS = 602,
     FLUSH_CLUSTERS = 603,
     SET_CLUSTER_PATH = 604,
+    SET_CLUSTER_FLUSH_WATERMARK = 605,
+    SET_CLUSTER_FILTERS = 606,
+    GET_CLUSTER_FILTER_STATS = 607,
+    SET_CLUSTER_OUTPUT_FORMAT = 608,
 
 // Commands to control the histogramming server
     GET_HISTOGRAM_SERVER_PATH = 700,
     SET_HISTOGRAM_INPUT_SERVER = 701,
     SET_HISTOGRAM_OUTPUT_PERIOD = 702,
+    SET_HISTOGRAM_COUNTER_WIDTH = 703,
+    SET_HISTOGRAM_THREADS = 704,
+    SET_HISTOGRAM_PRODUCTS = 705,
+    SET_HISTOGRAM_ENCODING = 706,
+    SET_HISTOGRAM_MODE = 707,
+    RESET_HISTOGRAM = 708,
+    GET_HISTOGRAM_IMAGE = 709,
+    SET_TOF_HISTOGRAM = 710,
+    SET_HISTOGRAM_PYRAMID = 711,
+    GET_HISTOGRAM_REGION = 712,
+    SET_ROI_REGIONS = 713,
+    SET_ROI_OUTPUT_PERIOD = 714,
+    SET_HISTOGRAM_VOLUME = 715,
+    GET_VOLUME_SLICE = 716,
+    GET_VOLUME_PROJECTION = 717,
+    SET_TOT_CUBE = 718,
+    GET_TOT_CUBE = 719,
+    SAVE_TOT_CUBE = 720,
+    SET_FRAME_STACK = 721,
+    SET_FRAME_STACK_FILE = 722,
+    SET_SCAN_GATE = 723,
+    GET_SCAN_GATE_COUNT = 724,
 
 // Error codes
     INVALID_COMMAND_DATA = 993,
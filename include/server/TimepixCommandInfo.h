@@ -1,16 +1,41 @@
 #ifndef TIMEPIXCOMMANDINFO_H
 #define TIMEPIXCOMMANDINFO_H
 
+#include <memory>
+#include <string>
+
 #include "common_defs.h"
 #include "TimepixCodes.h"
 #include "ServerCodes.h"
 
 class PythonConnectionManager;
+struct BatchReply;
+
+// the client a reply goes to: its ROUTER identity, and whether it sent an empty delimiter frame ( REQ clients do )
+struct ClientId {
+    std::string identity {};
+    bool delimited {true};
+    std::shared_ptr<BatchReply> batch {}; // set for the sub-commands of a batch, whose replies are collected instead
+    std::size_t batch_index {};
+};
+
+// what a queued command runs: a single Timepix command, or a server job built out of many; a job holds the command
+// channel to itself, so it only starts once the commands before it have finished, and nothing after it starts until it
+// has finished too
+enum class CommandJob {
+    TPX_COMMAND,
+    PIXEL_UPLOAD,
+    SCAN,
+    EQUALIZATION
+};
 
 struct TimepixCommandInfo {
     TpxCommand command;
     DataVec data;
     PythonConnectionManager *sender;
+    ClientId client {};
+    ServerCommand reply_code {ServerCommand::ERROR_OCCURED};
+    CommandJob job {CommandJob::TPX_COMMAND};
 };
 
 #endif // TIMEPIXCOMMANDINFO_H
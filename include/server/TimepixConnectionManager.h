@@ -3,6 +3,11 @@
 
 #include <string>
 #include <deque>
+#include <list>
+#include <map>
+#include <memory>
+#include <optional>
+#include <chrono>
 #include <utility>
 
 #include "asio.hpp"
@@ -25,6 +30,7 @@ public:
     void poll();
 
     void queueCommand(PythonConnectionManager *sender, TpxCommand command, DataVec data = {});
+    void queueJob(PythonConnectionManager *sender, CommandJob job, DataVec data);
 
     void attemptConnection(const std::string &host_ip, int host_port, const std::string &server_ip, int server_port, bool wait=false);
     void initializeConnection(const asio::error_code &code);
@@ -35,17 +41,93 @@ public:
 
     template<std::size_t sz>
     void genericHandler(const DataVec &data);
+    template<TpxCommand cmd>
+    void telemetryHandler(const DataVec &data);
 
     std::deque<TimepixCommandInfo> getCommandQueue();
 
     void clearAnyClientRequest();
     void sendServerResetNotice();
 
+    static constexpr std::size_t PIXEL_CONFIG_COLUMNS = 256;
+    static constexpr std::size_t PIXEL_CONFIG_COLUMN_WORDS = 48; // 256 pixels of 6 bits each
+
+    // the next upload sends every column, rather than only those that differ from the last upload
+    void invalidatePixelConfig();
+
+    // slow-control readings are refreshed in the background at this period, and client queries are answered from
+    // the cache while it is fresh; zero turns the cache off
+    void setTelemetryPeriod(std::chrono::milliseconds period);
+    // answers a slow-control GET from the cache if it is fresh, with the reading's age in ms after it if with_age is
+    // set; returns false if the GET has to go to the hardware
+    bool answerFromTelemetry(PythonConnectionManager *sender, TpxCommand command, bool with_age);
+
+    // answers a GET with the value this server last set, if it knows it; returns false if the GET has to go to the
+    // hardware
+    bool answerFromRegisterCache(PythonConnectionManager *sender, TpxCommand command, const DataVec &data);
+    void invalidateRegisterCache();
+
+    // the reply to a single command, with the error code the SPIDR reported for it
+    struct Reply {
+        DataVec data {};
+        std::uint32_t error {0};
+    };
+
+    // sends a command and waits for its reply; empty if the deadline passes or the connection is shut down
+    asio::awaitable<std::optional<Reply>> execute(TpxCommand cmd, DataVec data, std::chrono::milliseconds deadline);
+
 private:
+    static constexpr std::size_t MAX_IN_FLIGHT = 4;
+    static constexpr std::size_t MAX_READ_ATTEMPTS = 3;
+    static constexpr std::chrono::milliseconds DEFAULT_DEADLINE {1000};
+    static constexpr std::size_t REPLY_HEADER_BYTES = 16;
+    static constexpr std::size_t MAX_REPLY_BYTES = 64*1024;
+
+    // a client request, from when it leaves the queue until its client has been answered
+    struct ActiveCommand {
+        TimepixCommandInfo info;
+        bool finished {false};
+    };
+
+    // a single command on the wire; the timer runs out at the deadline, or is cancelled early when the reply arrives
+    struct PendingReply {
+        PendingReply(TpxCommand cmd, const DataVec &data, asio::io_context &io) : command(cmd), request(data), signal(io) {}
+
+        TpxCommand command;
+        DataVec request;
+        asio::steady_timer signal;
+        std::optional<Reply> reply {};
+        bool abandoned {false}; // the deadline passed; the reply is dropped when it arrives
+    };
+
+    struct TelemetryValue {
+        std::uint32_t value;
+        std::chrono::steady_clock::time_point time;
+    };
+
+    asio::awaitable<void> runCommand(std::shared_ptr<ActiveCommand> command);
+    asio::awaitable<void> runPixelConfigUpload(std::shared_ptr<ActiveCommand> command);
+    asio::awaitable<void> runScan(std::shared_ptr<ActiveCommand> command);
+    asio::awaitable<void> runEqualization(std::shared_ptr<ActiveCommand> command);
+    asio::awaitable<std::optional<std::size_t>> uploadPixelMatrix(const DataVec &matrix); // the number of columns sent
+    asio::awaitable<void> refreshTelemetry();
+    static std::optional<std::pair<TpxCommand, std::uint32_t>> getRegisterCacheEntry(TpxCommand cmd, const DataVec &data); // for a SET
+    void updateRegisterCache(TpxCommand cmd, const DataVec &data, bool succeeded);
+    void finishCommand(ActiveCommand &command);
+    bool isChannelHeld() const; // whether a server job has the command channel to itself
+
+    static DataVec buildMessage(TpxCommand cmd, const DataVec &data); // in network byte order
     void sendCommand(TpxCommand cmd, const DataVec &data={}, bool noreply=false);
+    void startNextWrite();
     void commandSent(const asio::error_code &err, std::size_t bytes_sent);
-    void processRecv(TpxCommand cmd, const DataVec data);
-    void commandRecv(const asio::error_code &err, std::size_t bytes_received);
+    void startReading();
+    void dataRecv(const asio::error_code &err, std::size_t bytes_received);
+    void processFrames();
+    void processReply(std::uint8_t *frame, std::size_t num_bytes);
+    void processRecv(const TimepixCommandInfo &info, const Reply &reply);
+    void failActiveCommands(ServerCommand errcode);
+    void cancelPendingReplies();
+    void resetModule();
 
     std::string getErrorString(std::uint32_t err_code);
 
@@ -61,14 +143,25 @@ private:
 
     bool mIsConnected {false};
     bool mIsCancelled {false};
-    bool mIsExecutingCommand {false};
+    bool mIsWriting {false};
+
+    PythonConnectionManager *mLastCommandSource {nullptr}; // the sender of the reply being handled
+    const DataVec *mLastRequest {nullptr}; // the client's data for the reply being handled
+    std::uint32_t mLastReplyError {0}; // the SPIDR error code of the reply being handled
+    std::deque<DataVec> mWriteQueue {}; // the front is being written
+    std::vector<std::uint8_t> mReadChunk = std::vector<std::uint8_t>(4096);
+    std::vector<std::uint8_t> mRecvBuffer {}; // bytes received but not yet part of a complete reply
+
+    std::optional<DataVec> mPixelConfigShadow {}; // the matrix last uploaded successfully, if the chip still holds it
 
-    PythonConnectionManager *mLastCommandSource {nullptr};
-    TpxCommand mExpectedReply { TpxCommand::CMD_NOREPLY };
-    std::vector<std::uint8_t> mCommandBuffer = std::vector<std::uint8_t>(1024);
-    std::vector<std::uint8_t> mResponseBuffer = std::vector<std::uint8_t>(1024);
+    std::chrono::milliseconds mTelemetryPeriod {1000};
+    std::map<TpxCommand, TelemetryValue> mTelemetry {};
+
+    std::map<std::pair<TpxCommand, std::uint32_t>, DataVec> mRegisterCache {}; // GET reply by GET command and register
 
     std::deque<TimepixCommandInfo> mQueuedCommands;
+    std::list<std::shared_ptr<ActiveCommand>> mActiveCommands {};
+    std::deque<std::shared_ptr<PendingReply>> mPendingReplies {}; // in the order the commands were sent
 
 };
 
@@ -83,4 +176,21 @@ void TimepixConnectionManager::genericHandler(const DataVec &data) {
         mLastCommandSource->sendResponse(data);
 }
 
+template<TpxCommand cmd>
+void TimepixConnectionManager::telemetryHandler(const DataVec &data) {
+    if(data.size() != 1) {
+        mLastCommandSource->sendError(ServerCommand::INVALID_COMMAND_DATA);
+        return;
+    }
+
+    // a value read for a client is as good as one read by the background refresh, unless the SPIDR reported an error
+    if(mTelemetryPeriod.count() != 0 && !mLastReplyError)
+        mTelemetry[cmd] = {data[0], std::chrono::steady_clock::now()};
+
+    if(!mLastRequest->empty() && (*mLastRequest)[0])
+        mLastCommandSource->sendResponse({data[0], 0});
+    else
+        mLastCommandSource->sendResponse(data);
+}
+
 #endif //TPXSERVER_TIMEPIXCONNECTIONMANAGER_H
@@ -0,0 +1,55 @@
+#ifndef TOFACCUMULATOR_H
+#define TOFACCUMULATOR_H
+
+#include <cstdint>
+#include <vector>
+
+// Time-of-flight spectrum settings. The ToF of a hit is its ToA relative to the most recent trigger, taken as
+// (ToA - offset) mod period since the stream carries no trigger packets; all times are in ToA units (1.5625 ns).
+// Bin i covers ToF [i*bin_width, (i+1)*bin_width). Only hits with x0 <= x < x1 and y0 <= y < y1 are counted.
+struct TofSettings {
+    std::uint64_t period {0};
+    std::uint64_t offset {0};
+    std::uint32_t bin_width {1};
+    std::uint32_t num_bins {0}; // 0 disables the spectrum
+    std::uint32_t x0 {0};
+    std::uint32_t y0 {0};
+    std::uint32_t x1 {256};
+    std::uint32_t y1 {256};
+
+    static constexpr std::uint32_t MAX_BINS = 1 << 20;
+
+    // words are [period_lo, period_hi, offset_lo, offset_hi, bin_width, num_bins], optionally followed by the region
+    // [x0, y0, x1, y1]; returns false if they do not describe a valid spectrum
+    bool fromConfigWords(const std::uint32_t *words, std::size_t num_words);
+
+    bool isEnabled() const {
+        return num_bins != 0;
+    }
+};
+
+class TofAccumulator {
+
+public:
+    void setSettings(const TofSettings &settings); // also clears the spectrum
+    const TofSettings& getSettings() const;
+
+    void addPackets(const std::uint64_t *data, std::size_t num_packets);
+    void addTo(std::vector<std::uint64_t> &total) const; // total must have num_bins entries
+    void clear();
+
+private:
+    template<bool POW2_PERIOD, bool POW2_WIDTH>
+    void computeBins(const std::uint64_t *packets, std::size_t num_packets);
+
+    TofSettings mSettings {};
+    std::uint64_t mShift {0}; // added to each ToA so that ToA + shift is 0 at a trigger
+    std::uint64_t mPeriodMask {0}; // period - 1 when the period is a power of two
+    int mWidthShift {0}; // log2(bin_width) when the bin width is a power of two
+
+    std::vector<std::uint32_t> mCounts {}; // num_bins + 1 entries, the last collecting hits outside the range
+    std::vector<std::uint32_t> mBins {};
+
+};
+
+#endif // TOFACCUMULATOR_H
@@ -0,0 +1,46 @@
+#ifndef TOTCUBE_H
+#define TOTCUBE_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// A ToT spectrum for every pixel, held in one array with each pixel's num_bins counters next to each other
+// ( index (x + 256*y)*num_bins + bin ). Bin b covers ToT [b*bin_width, (b+1)*bin_width); larger ToTs go in the last bin.
+//
+// Saved files have the layout (all words big-endian):
+//      "TOTCUBE1"                          8 bytes
+//      number of pixels                    4 bytes
+//      number of bins                      4 bytes
+//      bin width                           4 bytes
+//      reserved                            4 bytes
+//      counts                              4 bytes each, pixel by pixel
+class TotCube {
+
+public:
+    static constexpr std::size_t NUM_PIXELS = 256*256;
+    static constexpr std::uint32_t MAX_BINS = 1024;
+    static constexpr std::size_t MAX_READ_WORDS = 1 << 20; // per getPixels call, so one reply is at most 4 MB
+
+    bool setBins(std::uint32_t num_bins, std::uint32_t bin_width); // 0 bins disables the cube; also clears it
+    bool isEnabled() const;
+    std::uint32_t getNumBins() const;
+
+    // as for VolumeAccumulator, the indices are computed per worker and then counted atomically into the one cube
+    void computeIndices(const std::uint64_t *data, std::size_t num_packets, std::vector<std::uint32_t> &indices) const;
+    void addIndices(const std::vector<std::uint32_t> &indices); // safe to call from several threads at once; saturates
+    void clear();
+
+    // false if the range is outside the cube, or holds more than MAX_READ_WORDS counters
+    bool getPixels(std::size_t first_pixel, std::size_t num_pixels, std::vector<std::uint32_t> &output) const;
+    bool save(const std::string &path) const;
+
+private:
+    std::uint32_t mNumBins {0};
+    std::uint32_t mBinWidth {1};
+
+    std::vector<std::uint32_t> mCounts {};
+
+};
+
+#endif // TOTCUBE_H
@@ -9,6 +9,7 @@
 #include "zmq.hpp"
 
 #include "ServerCodes.h"
+#include "PacketDecoder.h"
 
 class UdpThread;
 
@@ -50,9 +51,7 @@ private:
     std::vector<std::uint64_t> mTempBuffer {}; // allocated to the same size as mUdpBuffer; this avoids constant malloc's
     std::unique_ptr<zmq::socket_t> mPublishSocket {nullptr};
 
-    std::uint8_t mRolloverCounter {0};
-    bool mHalfwayToRollover {false};
-    std::uint64_t mLastToA {0};
+    PacketDecoder mDecoder {};
 
     int mReceivedChunks {0};
 
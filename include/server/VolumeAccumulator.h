@@ -0,0 +1,65 @@
+#ifndef VOLUMEACCUMULATOR_H
+#define VOLUMEACCUMULATOR_H
+
+#include <cstdint>
+#include <vector>
+
+#include "TofAccumulator.h"
+
+// (x, y, ToF) histogram. The ToF axis is described as for the ToF spectrum ( the region fields are ignored ) and x and
+// y are binned by 2^xy_bin_shift to keep the volume small. Counts are stored ToF bin by ToF bin, each bin a
+// width x width image indexed as x + width*y, so that slicing reads contiguous memory.
+struct VolumeSettings {
+    TofSettings tof {}; // tof.num_bins == 0 disables the volume
+    std::uint32_t xy_bin_shift {0};
+
+    static constexpr std::uint64_t MAX_BYTES = static_cast<std::uint64_t>(512) << 20;
+
+    // words are the 6 ToF axis words of TofSettings followed by xy_bin_shift ( 0 to 3 )
+    bool fromConfigWords(const std::uint32_t *words, std::size_t num_words);
+
+    std::size_t getWidth() const {
+        return static_cast<std::size_t>(256) >> xy_bin_shift;
+    }
+
+    std::size_t getNumVoxels() const {
+        return getWidth() * getWidth() * tof.num_bins;
+    }
+};
+
+class VolumeAccumulator {
+
+public:
+    enum ProjectionAxis : std::uint32_t {
+        ALONG_TOF = 0,  // width x width image, x + width*y
+        ALONG_Y = 1,    // x against ToF, x + width*tof
+        ALONG_X = 2     // y against ToF, y + width*tof
+    };
+
+    void setSettings(const VolumeSettings &settings); // also clears the volume
+    const VolumeSettings& getSettings() const;
+
+    // the indices are computed separately from the counting, which is done with atomic increments, so that the
+    // workers share one volume rather than each keeping a copy of it
+    void computeIndices(const std::uint64_t *data, std::size_t num_packets, std::vector<std::uint32_t> &indices) const;
+    void addIndices(const std::vector<std::uint32_t> &indices); // safe to call from several threads at once; saturates
+    void clear();
+
+    // sum of the ToF bins tof_start <= bin < tof_end, as a width x width image
+    bool getSlice(std::size_t tof_start, std::size_t tof_end, std::vector<std::uint64_t> &output) const;
+    bool getProjection(ProjectionAxis axis, std::vector<std::uint64_t> &output) const;
+
+private:
+    template<bool POW2_PERIOD, bool POW2_WIDTH>
+    void computeIndicesImpl(const std::uint64_t *data, std::size_t num_packets, std::uint32_t *indices) const;
+
+    VolumeSettings mSettings {};
+    std::uint64_t mShift {0};
+    std::uint64_t mPeriodMask {0};
+    int mWidthShift {0};
+
+    std::vector<std::uint32_t> mCounts {}; // num_voxels + 1 entries, the last collecting hits outside the ToF range
+
+};
+
+#endif // VOLUMEACCUMULATOR_H
@@ -0,0 +1,365 @@
+// Offline reprocessing and benchmark tool for *.tpx3 files saved by the server.
+//
+// This runs the same decoder, clustering engine and histogram code as the live server on a saved file,
+// spread across all cores, and reports the throughput of each stage. Usage:
+//
+//      TpxOffline <input.tpx3> [--threads N] [--xy-sep N] [--t-sep N] [--max-t-sep N]
+//                 [--clusters out.clusters] [--image out.txt] [--shape-bench]
+//
+// Each thread processes a contiguous block of the file. Clusters that straddle two blocks are split,
+// so use --threads 1 to reproduce the live server's cluster output exactly.
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "server/PacketDecoder.h"
+#include "server/ClusterEngine.h"
+#include "server/ClusterFileWriter.h"
+#include "server/HistogramAccumulator.h"
+
+// Read-only memory mapping of a whole file
+class MappedFile {
+
+public:
+    explicit MappedFile(const std::string &path) {
+#ifdef _WIN32
+        mFile = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+        if(mFile == INVALID_HANDLE_VALUE)
+            return;
+        LARGE_INTEGER size;
+        if(!GetFileSizeEx(mFile, &size) || size.QuadPart == 0)
+            return;
+        mMapping = CreateFileMappingA(mFile, nullptr, PAGE_READONLY, 0, 0, nullptr);
+        if(!mMapping)
+            return;
+        mData = static_cast<const std::uint8_t*>(MapViewOfFile(mMapping, FILE_MAP_READ, 0, 0, 0));
+        mSize = mData ? static_cast<std::size_t>(size.QuadPart) : 0;
+#else
+        mFile = ::open(path.c_str(), O_RDONLY);
+        if(mFile < 0)
+            return;
+        struct stat st {};
+        if(fstat(mFile, &st) != 0 || st.st_size == 0)
+            return;
+        auto ptr = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, mFile, 0);
+        if(ptr == MAP_FAILED)
+            return;
+        madvise(ptr, st.st_size, MADV_SEQUENTIAL);
+        mData = static_cast<const std::uint8_t*>(ptr);
+        mSize = st.st_size;
+#endif
+    }
+
+    ~MappedFile() {
+#ifdef _WIN32
+        if(mData)
+            UnmapViewOfFile(mData);
+        if(mMapping)
+            CloseHandle(mMapping);
+        if(mFile != INVALID_HANDLE_VALUE)
+            CloseHandle(mFile);
+#else
+        if(mData)
+            munmap(const_cast<std::uint8_t*>(mData), mSize);
+        if(mFile >= 0)
+            ::close(mFile);
+#endif
+    }
+
+    MappedFile(const MappedFile &rhs) = delete;
+
+    const std::uint8_t* data() const { return mData; }
+    std::size_t size() const { return mSize; }
+
+private:
+#ifdef _WIN32
+    HANDLE mFile {INVALID_HANDLE_VALUE};
+    HANDLE mMapping {nullptr};
+#else
+    int mFile {-1};
+#endif
+    const std::uint8_t *mData {nullptr};
+    std::size_t mSize {0};
+
+};
+
+struct Options {
+    std::string input_path;
+    std::string cluster_path;
+    std::string image_path;
+    unsigned num_threads = std::max(1u, std::thread::hardware_concurrency());
+    int xy_sep = 5;
+    int t_sep = 20;
+    int max_t_sep = 50000;
+    bool shape_bench = false;
+};
+
+struct Chunk {
+    std::size_t word_offset; // first packet of the chunk, in 64-bit words from the start of the file
+    std::size_t num_words;
+};
+
+std::chrono::high_resolution_clock::time_point startClock() {
+    return std::chrono::high_resolution_clock::now();
+}
+
+double stopClock(std::chrono::high_resolution_clock::time_point start_t) {
+    return std::chrono::duration<double, std::milli>(startClock() - start_t).count();
+}
+
+void printStage(const std::string &name, double ms, std::size_t num_hits, const std::string &extra = "") {
+    std::cout << std::left << std::setw(12) << name << std::right << std::fixed << std::setprecision(1)
+              << std::setw(10) << ms << " ms  " << std::setw(8) << (num_hits / (ms * 1e3)) << " Mhit/s";
+    if(!extra.empty())
+        std::cout << "  " << extra;
+    std::cout << std::endl;
+}
+
+void runParallel(unsigned num_threads, const std::function<void(unsigned)> &fn) {
+    std::vector<std::thread> threads;
+    threads.reserve(num_threads);
+    for(unsigned ix = 0; ix < num_threads; ++ix)
+        threads.emplace_back(fn, ix);
+    for(auto &t : threads)
+        t.join();
+}
+
+bool parseOptions(int argc, char *argv[], Options &opts) {
+
+    // a missing or non-numeric value makes std::stoi throw, which is reported as bad usage
+    try {
+
+        for(int ix = 1; ix < argc; ++ix) {
+            std::string arg = argv[ix];
+            auto next = [&]() -> std::string {
+                return (ix + 1 < argc) ? argv[++ix] : "";
+            };
+            if(arg == "--threads")
+                opts.num_threads = std::max(1, std::stoi(next()));
+            else if(arg == "--xy-sep")
+                opts.xy_sep = std::stoi(next());
+            else if(arg == "--t-sep")
+                opts.t_sep = std::stoi(next());
+            else if(arg == "--max-t-sep")
+                opts.max_t_sep = std::stoi(next());
+            else if(arg == "--clusters")
+                opts.cluster_path = next();
+            else if(arg == "--image")
+                opts.image_path = next();
+            else if(arg == "--shape-bench")
+                opts.shape_bench = true;
+            else if(opts.input_path.empty() && !arg.starts_with("--"))
+                opts.input_path = arg;
+            else
+                return false;
+        }
+
+    } catch (const std::logic_error &) { // std::invalid_argument or std::out_of_range
+        return false;
+    }
+
+    return !opts.input_path.empty();
+
+}
+
+// Finds the "TPX3" chunks written by UdpConnectionManager; each has an 8-byte header with a little-endian size
+std::vector<Chunk> findChunks(const std::uint8_t *bytes, std::size_t size) {
+
+    std::vector<Chunk> chunks;
+    std::size_t offset = 0;
+
+    while(offset + 8 <= size) {
+        if(std::memcmp(bytes + offset, "TPX3", 4) != 0) {
+            std::cout << "Error: chunk header at byte " << offset << " was not 'TPX3'; ignoring the rest of the file" << std::endl;
+            break;
+        }
+        std::size_t chunk_size = bytes[offset + 6] | (bytes[offset + 7] << 8);
+        offset += 8;
+        chunk_size = std::min(chunk_size, size - offset) & ~static_cast<std::size_t>(7);
+        chunks.push_back({offset / 8, chunk_size / 8});
+        offset += chunk_size;
+    }
+
+    return chunks;
+
+}
+
+double benchmarkClustering(const std::vector<std::uint64_t> &hits, bool shape_stats) {
+
+    ClusterEngine::setShapeOutput(shape_stats);
+
+    // best of several runs, to keep the comparison from being dominated by cache and clock noise
+    double best_ms = 0;
+    for(int run = 0; run < 3; ++run) {
+        ClusterEngine engine;
+        std::vector<std::uint64_t> output;
+        output.reserve(hits.size());
+
+        auto start_t = startClock();
+        engine.addPackets(hits.data(), hits.size(), output);
+        engine.flush(output);
+        auto ms = stopClock(start_t);
+
+        best_ms = (run == 0) ? ms : std::min(best_ms, ms);
+    }
+
+    return best_ms;
+
+}
+
+void saveImage(const std::vector<std::uint32_t> &image, const std::string &fname) {
+
+    std::ofstream out(fname);
+    for(auto y = 0; y < 256; ++y) {
+        for(auto x = 0; x < 256; ++x) {
+            out << image[y * 256 + x];
+            if(x != 255)
+                out << " ";
+        }
+        out << "\n";
+    }
+
+}
+
+int main(int argc, char *argv[]) {
+
+    Options opts;
+    if(!parseOptions(argc, argv, opts)) {
+        std::cout << "Usage: " << argv[0] << " <input.tpx3> [--threads N] [--xy-sep N] [--t-sep N] [--max-t-sep N]"
+                  << " [--clusters out.clusters] [--image out.txt] [--shape-bench]" << std::endl;
+        return 1;
+    }
+
+    auto map_t = startClock();
+    MappedFile file(opts.input_path);
+    if(!file.data()) {
+        std::cout << "Unable to open " << opts.input_path << std::endl;
+        return 1;
+    }
+
+    auto chunks = findChunks(file.data(), file.size());
+    auto words = reinterpret_cast<const std::uint64_t*>(file.data());
+    std::cout << "Mapped " << (file.size() / 1e6) << " MB (" << chunks.size() << " chunks) in " << stopClock(map_t) << " ms, using "
+              << opts.num_threads << " threads" << std::endl;
+
+    // split the chunks into one contiguous block per thread, with roughly equal numbers of packets
+    std::size_t total_words = 0;
+    for(auto &chunk : chunks)
+        total_words += chunk.num_words;
+
+    auto num_blocks = static_cast<unsigned>(std::max<std::size_t>(1, std::min<std::size_t>(opts.num_threads, chunks.size())));
+    std::vector<std::size_t> block_starts(num_blocks + 1, chunks.size());
+    block_starts[0] = 0;
+    std::size_t running_words = 0;
+    unsigned next_block = 1;
+    for(std::size_t ix = 0; ix < chunks.size() && next_block < num_blocks; ++ix) {
+        if(running_words >= total_words * next_block / num_blocks)
+            block_starts[next_block++] = ix;
+        running_words += chunks[ix].num_words;
+    }
+
+    // decoding: blocks are decoded in parallel, then the ToA rollover is tracked across them in stream order
+    std::vector<std::vector<std::uint64_t>> blocks(num_blocks);
+
+    auto decode_t = startClock();
+    runParallel(num_blocks, [&](unsigned bix) {
+        std::size_t block_words = 0;
+        for(auto cix = block_starts[bix]; cix < block_starts[bix + 1]; ++cix)
+            block_words += chunks[cix].num_words;
+        auto &hits = blocks[bix];
+        hits.resize(block_words);
+        std::size_t num_hits = 0;
+        for(auto cix = block_starts[bix]; cix < block_starts[bix + 1]; ++cix)
+            num_hits += PacketDecoder::decodeHits(words + chunks[cix].word_offset, chunks[cix].num_words, hits.data() + num_hits);
+        hits.resize(num_hits);
+    });
+    PacketDecoder decoder;
+    std::size_t total_hits = 0;
+    for(auto &hits : blocks) {
+        decoder.extendToA(hits.data(), hits.size());
+        total_hits += hits.size();
+    }
+    printStage("Decoding", stopClock(decode_t), total_hits, std::to_string(total_hits) + " hits");
+
+    // clustering
+    ClusterEngine::setClusterParameters(opts.xy_sep, opts.t_sep, opts.max_t_sep);
+    ClusterEngine::setShapeOutput(false);
+
+    std::vector<std::vector<std::uint64_t>> clusters(num_blocks);
+    std::vector<std::array<std::uint64_t, ClusterEngine::NUM_REJECT_REASONS + 1>> cluster_stats(num_blocks);
+
+    auto cluster_t = startClock();
+    runParallel(num_blocks, [&](unsigned bix) {
+        ClusterEngine engine;
+        engine.addPackets(blocks[bix].data(), blocks[bix].size(), clusters[bix]);
+        engine.flush(clusters[bix]);
+        cluster_stats[bix] = engine.getFilterStatistics();
+    });
+    std::size_t total_clusters = 0;
+    for(auto &stats : cluster_stats)
+        total_clusters += stats[0];
+    printStage("Clustering", stopClock(cluster_t), total_hits, std::to_string(total_clusters) + " clusters");
+
+    // histogramming, with one partial image per thread
+    std::vector<HistogramAccumulator<std::uint32_t>> partials(num_blocks);
+
+    auto hist_t = startClock();
+    runParallel(num_blocks, [&](unsigned bix) {
+        partials[bix].addPackets(blocks[bix].data(), blocks[bix].size());
+    });
+    for(unsigned bix = 1; bix < num_blocks; ++bix)
+        partials[0].add(partials[bix]);
+    printStage("Histogram", stopClock(hist_t), total_hits);
+
+    if(opts.shape_bench && total_hits) {
+        // single-threaded, on the largest block, so that the two runs see identical input
+        auto &hits = *std::max_element(blocks.begin(), blocks.end(), [](auto &a, auto &b) { return a.size() < b.size(); });
+        auto plain_ms = benchmarkClustering(hits, false);
+        auto shape_ms = benchmarkClustering(hits, true);
+        std::cout << std::fixed << std::setprecision(2)
+                  << "Shape statistics: " << (plain_ms * 1e6 / hits.size()) << " ns/hit centroids only, "
+                  << (shape_ms * 1e6 / hits.size()) << " ns/hit with moments ("
+                  << ((shape_ms - plain_ms) * 1e6 / hits.size()) << " ns/hit overhead)" << std::endl;
+        ClusterEngine::setShapeOutput(false);
+    }
+
+    if(!opts.cluster_path.empty()) {
+        ClusterFileWriter writer;
+        if(!writer.open(opts.cluster_path, ClusterEngine::getWordsPerCluster())) {
+            std::cout << "Unable to open " << opts.cluster_path << std::endl;
+            return 1;
+        }
+        for(auto &block : clusters)
+            writer.write(block.data(), block.size());
+        writer.close();
+        std::cout << "Saved " << total_clusters << " clusters to " << opts.cluster_path << std::endl;
+    }
+
+    if(!opts.image_path.empty()) {
+        saveImage(partials[0].getCounts(), opts.image_path);
+        std::cout << "Saved image to " << opts.image_path << std::endl;
+    }
+
+    return 0;
+
+}
@@ -0,0 +1,355 @@
+#include "server/ClusterEngine.h"
+
+#include <cmath>
+#include <limits>
+#include <algorithm>
+
+struct Packet {
+
+    std::uint64_t raw_value;
+
+    Packet(std::uint64_t val) :
+        raw_value(val) {}
+
+    int x() const { return (raw_value >> 56) & 0xFF; }
+    int y() const { return (raw_value >> 48) & 0xFF; }
+    std::int64_t t() const { return raw_value & 0x3FFFFFFFFF; }
+    int tot() const { return (raw_value >> 38) & 0x3FF; }
+
+};
+
+struct ClusterSettings {
+    int xy_sep;
+    int t_sep;
+    std::size_t max_t_separation = 20000;
+    bool shape_stats = false; // track second moments and emit a shape word after each centroid
+};
+
+struct Cluster {
+
+    static ClusterSettings settings;
+
+    double xmean, ymean, tmean, tot_total;
+    int xmin, xmax, ymin, ymax;
+    std::int64_t tmin, tmax;
+    int num_hits {1};
+    bool dense {false}; // true once the cluster contains at least one density core hit
+    double m2x {0}, m2y {0}, cxy {0}; // ToT-weighted sums of squared/cross deviations from the means
+    std::chrono::steady_clock::time_point last_update {}; // wall-clock time of the batch that last extended this cluster
+
+    Cluster(const Packet &p) :
+        xmean(p.x()),
+        ymean(p.y()),
+        tmean(p.t()),
+        tot_total(p.tot()),
+        xmin(p.x() - settings.xy_sep),
+        xmax(p.x() + settings.xy_sep),
+        ymin(p.y() - settings.xy_sep),
+        ymax(p.y() + settings.xy_sep),
+        tmin(p.t() - settings.t_sep),
+        tmax(p.t() + settings.t_sep) {}
+
+    void addClick(const Packet &p) {
+        ++num_hits;
+        // weighted Welford (West) update, which stays accurate for large ToA values and long clusters
+        double w = p.tot();
+        double new_total = tot_total + w;
+        if(new_total > 0) {
+            double frac = w / new_total;
+            double dx = p.x() - xmean;
+            double dy = p.y() - ymean;
+            xmean += dx * frac;
+            ymean += dy * frac;
+            tmean += (p.t() - tmean) * frac;
+            if(settings.shape_stats) {
+                m2x += w * dx * (p.x() - xmean);
+                m2y += w * dy * (p.y() - ymean);
+                cxy += w * dx * (p.y() - ymean);
+            }
+        }
+        tot_total = new_total;
+        xmin = std::min(xmin, p.x() - settings.xy_sep);
+        xmax = std::max(xmax, p.x() + settings.xy_sep);
+        ymin = std::min(ymin, p.y() - settings.xy_sep);
+        ymax = std::max(ymax, p.y() + settings.xy_sep);
+        tmin = std::min(tmin, p.t() - settings.t_sep);
+        tmax = std::max(tmax, p.t() + settings.t_sep);
+    }
+
+    void addCluster(const Cluster &c) {
+        num_hits += c.num_hits;
+        dense |= c.dense;
+        // pairwise (Chan) combination of the two sets of moments
+        double new_total = tot_total + c.tot_total;
+        if(new_total > 0) {
+            double frac = c.tot_total / new_total;
+            double dx = c.xmean - xmean;
+            double dy = c.ymean - ymean;
+            if(settings.shape_stats) {
+                double cross_weight = tot_total * frac;
+                m2x += c.m2x + dx * dx * cross_weight;
+                m2y += c.m2y + dy * dy * cross_weight;
+                cxy += c.cxy + dx * dy * cross_weight;
+            }
+            xmean += dx * frac;
+            ymean += dy * frac;
+            tmean += (c.tmean - tmean) * frac;
+        }
+        tot_total = new_total;
+        xmin = std::min(xmin, c.xmin);
+        xmax = std::max(xmax, c.xmax);
+        ymin = std::min(ymin, c.ymin);
+        ymax = std::max(ymax, c.ymax);
+        tmin = std::min(tmin, c.tmin);
+        tmax = std::max(tmax, c.tmax);
+    }
+
+    std::uint64_t toRawValue() const {
+        std::uint64_t val = 0;
+        val |= ((static_cast<std::uint64_t>(xmean) & 0xFF) << 56);
+        val |= ((static_cast<std::uint64_t>(ymean) & 0xFF) << 48);
+        val |= (static_cast<std::uint64_t>(tmean) & 0x3FFFFFFFFF);
+        return val;
+    }
+
+    double sigmaX() const { return tot_total > 0 ? std::sqrt(m2x / tot_total) : 0; }
+    double sigmaY() const { return tot_total > 0 ? std::sqrt(m2y / tot_total) : 0; }
+    double covarianceXY() const { return tot_total > 0 ? cxy / tot_total : 0; }
+    double radius() const { return tot_total > 0 ? std::sqrt((m2x + m2y) / tot_total) : 0; } // ToT-weighted RMS radius
+
+    // Shape word, sent after the centroid when shape_stats is enabled. Each field is 16 bits in units of 1/256 px:
+    //      sigma X:        bits 48-63
+    //      sigma Y:        bits 32-47
+    //      covariance XY:  bits 16-31  ( signed, units of 1/256 px^2 )
+    //      radius:         bits  0-15
+    std::uint64_t toShapeValue() const {
+        auto fixed = [](double v) {
+            return static_cast<std::uint64_t>(std::clamp(std::lround(v * 256), 0L, 0xFFFFL));
+        };
+        auto cov = static_cast<std::int16_t>(std::clamp(std::lround(covarianceXY() * 256), -0x8000L, 0x7FFFL));
+        std::uint64_t val = 0;
+        val |= fixed(sigmaX()) << 48;
+        val |= fixed(sigmaY()) << 32;
+        val |= static_cast<std::uint64_t>(static_cast<std::uint16_t>(cov)) << 16;
+        val |= fixed(radius());
+        return val;
+    }
+
+    bool containsClick(const Packet &p) {
+        return (xmin <= p.x()) && (xmax >= p.x()) && (ymin <= p.y()) && (ymax >= p.y()) && (tmin <= p.t()) && (tmax >= p.t());
+    }
+
+};
+
+struct ClusterList {
+
+    std::vector<Cluster> list {};
+
+    void add(const Cluster &c) {
+        list.push_back(c);
+    }
+
+    Cluster& get(std::size_t ix) {
+        return list[ix];
+    }
+
+    void remove(std::size_t ix) {
+        if (list.size() > 1) {
+            std::iter_swap(list.begin() + ix, list.end() - 1);
+            list.pop_back();
+        } else {
+            list.clear();
+        }
+    }
+
+    std::size_t size() const {
+        return list.size();
+    }
+
+};
+
+// default cluster settings
+ClusterSettings Cluster::settings = {
+    .xy_sep = 5,
+    .t_sep = 20,
+    .max_t_separation = 50000,
+    .shape_stats = false
+};
+
+constexpr std::size_t INITIAL_ARRAY_SIZE = 10000;
+constexpr std::int64_t NO_RECENT_HIT = std::numeric_limits<std::int64_t>::min() / 2;
+
+ClusterEngine::ClusterEngine() {
+
+    mOpenClusters = std::make_unique<ClusterList>();
+    mOpenClusters->list.reserve(INITIAL_ARRAY_SIZE);
+
+    mLastHitToA.resize(256*256, NO_RECENT_HIT);
+
+}
+
+ClusterEngine::~ClusterEngine() = default;
+
+void ClusterEngine::setClusterParameters(int max_sep_xy, int max_sep_t, int max_t_sep) {
+
+    Cluster::settings.xy_sep = max_sep_xy;
+    Cluster::settings.t_sep = max_sep_t;
+    Cluster::settings.max_t_separation = max_t_sep;
+
+}
+
+void ClusterEngine::setShapeOutput(bool enabled) {
+
+    Cluster::settings.shape_stats = enabled;
+
+}
+
+std::size_t ClusterEngine::getWordsPerCluster() {
+
+    return Cluster::settings.shape_stats ? 2 : 1;
+
+}
+
+void ClusterEngine::addPackets(const std::uint64_t *data, std::size_t num_packets, std::vector<std::uint64_t> &output) {
+
+    auto batch_time = std::chrono::steady_clock::now();
+
+    for(std::size_t ix = 0; ix < num_packets; ++ix) {
+
+        Packet click = data[ix];
+
+        bool is_core = (mFilters.density_min_neighbours > 0) && isDensityCore(click);
+
+        bool in_cluster = false;
+        Cluster *last_cluster = nullptr;
+
+        for(std::size_t cix = 0; cix < mOpenClusters->size(); ++cix) {
+            auto &cluster = mOpenClusters->get(cix);
+            if(cluster.containsClick(click)) {
+                cluster.addClick(click);
+                cluster.last_update = batch_time;
+                cluster.dense |= is_core;
+                if(in_cluster) {
+                    last_cluster->addCluster(cluster);
+                    mOpenClusters->remove(cix);
+                } else {
+                    in_cluster = true;
+                    last_cluster = &cluster;
+                }
+            }
+        }
+
+        if(!in_cluster) {
+            mOpenClusters->add(click); // create new cluster
+            mOpenClusters->list.back().last_update = batch_time;
+            mOpenClusters->list.back().dense = is_core;
+        }
+
+        for(std::int64_t cix = mOpenClusters->size() - 1; cix >= 0; --cix) { // reverse iteration, so that we don't accidentally remove prior objects while iterating
+            auto &cluster = mOpenClusters->get(cix);
+            if(click.t() > cluster.tmax + Cluster::settings.max_t_separation) {
+                finishCluster(cluster, output);
+                mOpenClusters->remove(cix);
+            }
+        }
+
+    }
+
+    if(num_packets)
+        mLastToA = Packet(data[num_packets - 1]).t();
+
+}
+
+void ClusterEngine::flush(std::vector<std::uint64_t> &output) {
+
+    for(std::size_t cix = 0; cix < mOpenClusters->size(); ++cix) {
+        finishCluster(mOpenClusters->get(cix), output);
+    }
+    mOpenClusters->list.clear();
+
+}
+
+void ClusterEngine::flushExpired(std::chrono::steady_clock::time_point idle_deadline, std::int64_t stream_lag, std::vector<std::uint64_t> &output) {
+
+    for(std::int64_t cix = mOpenClusters->size() - 1; cix >= 0; --cix) {
+        auto &cluster = mOpenClusters->get(cix);
+        bool idle = cluster.last_update < idle_deadline;
+        bool stale = (stream_lag > 0) && (cluster.tmax + stream_lag < mLastToA);
+        if(idle || stale) {
+            finishCluster(cluster, output);
+            mOpenClusters->remove(cix);
+        }
+    }
+
+}
+
+std::size_t ClusterEngine::getNumOpenClusters() const {
+
+    return mOpenClusters->size();
+
+}
+
+void ClusterEngine::finishCluster(const Cluster &cluster, std::vector<std::uint64_t> &output) {
+
+    if(cluster.num_hits < mFilters.min_hits) {
+        ++mRejectedClusters[REJECT_TOO_FEW_HITS];
+    } else if(cluster.tot_total < mFilters.min_tot) {
+        ++mRejectedClusters[REJECT_TOT_TOO_LOW];
+    } else if(mFilters.max_tot > 0 && cluster.tot_total > mFilters.max_tot) {
+        ++mRejectedClusters[REJECT_TOT_TOO_HIGH];
+    } else if(mFilters.density_min_neighbours > 0 && !cluster.dense) {
+        ++mRejectedClusters[REJECT_TOO_SPARSE];
+    } else {
+        ++mAcceptedClusters;
+        output.push_back(cluster.toRawValue());
+        if(Cluster::settings.shape_stats)
+            output.push_back(cluster.toShapeValue());
+    }
+
+}
+
+bool ClusterEngine::isDensityCore(const Packet &click) {
+
+    // DBSCAN-style core test: a hit is a core point if at least density_min_neighbours other pixels within
+    // density_radius were hit within density_time of it. Only the most recent hit of each pixel is kept, so
+    // repeated hits on a single hot pixel never count as neighbours of each other.
+    auto x = click.x(), y = click.y();
+    auto t = click.t();
+    auto r = mFilters.density_radius;
+
+    int neighbours = 0;
+    for(int ny = std::max(y - r, 0); ny <= std::min(y + r, 255); ++ny) {
+        for(int nx = std::max(x - r, 0); nx <= std::min(x + r, 255); ++nx) {
+            if(nx == x && ny == y)
+                continue;
+            if(std::abs(t - mLastHitToA[nx + ny*256]) <= mFilters.density_time)
+                ++neighbours;
+        }
+    }
+
+    mLastHitToA[x + y*256] = t;
+
+    return neighbours >= mFilters.density_min_neighbours;
+
+}
+
+void ClusterEngine::setFilters(const ClusterFilters &filters) {
+
+    mFilters = filters;
+    mFilters.density_radius = std::clamp(mFilters.density_radius, 0, 255);
+
+    std::fill(mLastHitToA.begin(), mLastHitToA.end(), NO_RECENT_HIT);
+    std::fill(mRejectedClusters.begin(), mRejectedClusters.end(), 0);
+    mAcceptedClusters = 0;
+
+}
+
+std::array<std::uint64_t, ClusterEngine::NUM_REJECT_REASONS + 1> ClusterEngine::getFilterStatistics() const {
+
+    std::array<std::uint64_t, NUM_REJECT_REASONS + 1> stats {};
+    stats[0] = mAcceptedClusters;
+    std::copy(mRejectedClusters.begin(), mRejectedClusters.end(), stats.begin() + 1);
+
+    return stats;
+
+}
@@ -0,0 +1,141 @@
+#include "server/ClusterFileWriter.h"
+
+#include <bit>
+
+constexpr std::size_t BATCH_WORDS = 64*1024; // 512 kB per write
+constexpr std::uint64_t HEADER_BYTES = 16;
+constexpr std::uint64_t INDEX_INTERVAL = static_cast<std::uint64_t>(1) << 26; // ~105 ms of ToA
+constexpr std::uint64_t TOA_MASK = 0x3FFFFFFFFF;
+
+// written as plain shifts so that the compiler can vectorise the loop over a whole batch
+constexpr std::uint64_t toBigEndian(std::uint64_t x) {
+    if constexpr (std::endian::native == std::endian::big) {
+        return x;
+    } else {
+        return ((x >> 56) & 0x00000000000000FF)
+             | ((x >> 40) & 0x000000000000FF00)
+             | ((x >> 24) & 0x0000000000FF0000)
+             | ((x >>  8) & 0x00000000FF000000)
+             | ((x <<  8) & 0x000000FF00000000)
+             | ((x << 24) & 0x0000FF0000000000)
+             | ((x << 40) & 0x00FF000000000000)
+             | ((x << 56) & 0xFF00000000000000);
+    }
+}
+
+ClusterFileWriter::~ClusterFileWriter() {
+
+    close();
+
+}
+
+bool ClusterFileWriter::open(const std::string &path, std::size_t words_per_cluster) {
+
+    close();
+
+    try {
+        mFile.open(path, std::ios_base::out | std::ios_base::binary);
+    } catch (...) {
+        return false;
+    }
+
+    if(!mFile.is_open())
+        return false;
+
+    mWordsPerCluster = words_per_cluster;
+    mNumClusters = 0;
+    mIndex.clear();
+    mNextIndexToA = 0;
+    mBuffer.clear();
+    mBuffer.reserve(BATCH_WORDS + words_per_cluster);
+
+    std::uint64_t reserved_count = 0;
+    mFile.write("CLUSTERS", 8);
+    mFile.write(reinterpret_cast<const char*>(&reserved_count), sizeof(reserved_count));
+
+    return true;
+
+}
+
+void ClusterFileWriter::close() {
+
+    if(!mFile.is_open())
+        return;
+
+    flushBuffer();
+
+    for(auto &[toa, offset] : mIndex) {
+        mBuffer.push_back(toBigEndian(toa));
+        mBuffer.push_back(toBigEndian(offset));
+    }
+    mBuffer.push_back(toBigEndian(mIndex.size()));
+    mBuffer.push_back(toBigEndian(INDEX_INTERVAL));
+    mBuffer.push_back(toBigEndian(mWordsPerCluster));
+    mFile.write(reinterpret_cast<const char*>(mBuffer.data()), mBuffer.size() * sizeof(std::uint64_t));
+    mFile.write("CLUSTIDX", 8);
+    mBuffer.clear();
+
+    auto count = toBigEndian(mNumClusters);
+    mFile.seekp(8);
+    mFile.write(reinterpret_cast<const char*>(&count), sizeof(count));
+
+    mFile.close();
+
+}
+
+bool ClusterFileWriter::isOpen() const {
+
+    return mFile.is_open();
+
+}
+
+std::size_t ClusterFileWriter::getWordsPerCluster() const {
+
+    return mWordsPerCluster;
+
+}
+
+std::uint64_t ClusterFileWriter::getNumClusters() const {
+
+    return mNumClusters;
+
+}
+
+void ClusterFileWriter::write(const std::uint64_t *data, std::size_t num_words) {
+
+    if(!mFile.is_open())
+        return;
+
+    for(std::size_t ix = 0; ix + mWordsPerCluster <= num_words; ix += mWordsPerCluster) {
+
+        auto toa = data[ix] & TOA_MASK;
+
+        // the ToA only jumps backwards by a large amount when the rollover counter is reset
+        if(toa >= mNextIndexToA || (!mIndex.empty() && toa + INDEX_INTERVAL < mIndex.back().first)) {
+            auto offset = HEADER_BYTES + mNumClusters * mWordsPerCluster * sizeof(std::uint64_t);
+            mIndex.emplace_back(toa, offset);
+            mNextIndexToA = (toa / INDEX_INTERVAL + 1) * INDEX_INTERVAL;
+        }
+
+        mBuffer.insert(mBuffer.end(), data + ix, data + ix + mWordsPerCluster);
+        ++mNumClusters;
+
+        if(mBuffer.size() >= BATCH_WORDS)
+            flushBuffer();
+
+    }
+
+}
+
+void ClusterFileWriter::flushBuffer() {
+
+    if(mBuffer.empty())
+        return;
+
+    for(auto &word : mBuffer)
+        word = toBigEndian(word);
+
+    mFile.write(reinterpret_cast<const char*>(mBuffer.data()), mBuffer.size() * sizeof(std::uint64_t));
+    mBuffer.clear();
+
+}
@@ -56,6 +56,22 @@ void ClusterThread::handleCommand(ServerCommand cmd, const DataVec &data) {
         setClusterPath(data);
         break;
 
+    case ServerCommand::SET_CLUSTER_FLUSH_WATERMARK:
+        setClusterFlushWatermark(data);
+        break;
+
+    case ServerCommand::SET_CLUSTER_FILTERS:
+        setClusterFilters(data);
+        break;
+
+    case ServerCommand::GET_CLUSTER_FILTER_STATS:
+        sendClusterFilterStats(data);
+        break;
+
+    case ServerCommand::SET_CLUSTER_OUTPUT_FORMAT:
+        setClusterOutputFormat(data);
+        break;
+
     default:
         sendError(ServerCommand::UNKNOWN_COMMAND);
         break;
@@ -144,3 +160,71 @@ void ClusterThread::setClusterPath(const DataVec &data) {
     }
 
 }
+
+void ClusterThread::setClusterFlushWatermark(const DataVec &data) {
+
+    // [idle deadline (ms), stream-time lag (ToA units)]; a value of zero disables that deadline
+    if(data.size() != 2) {
+        sendError(ServerCommand::INVALID_COMMAND_DATA);
+        return;
+    }
+
+    mClusterManager->setFlushWatermark(data[0], data[1]);
+
+    sendResponse(data);
+
+}
+
+void ClusterThread::setClusterFilters(const DataVec &data) {
+
+    // [min hits, min ToT, max ToT, density radius (px), density time (ToA units), density min neighbours]
+    if(data.size() != 6) {
+        sendError(ServerCommand::INVALID_COMMAND_DATA);
+        return;
+    }
+
+    mClusterManager->setClusterFilters({
+        .min_hits = static_cast<int>(data[0]),
+        .min_tot = static_cast<int>(data[1]),
+        .max_tot = static_cast<int>(data[2]),
+        .density_radius = static_cast<int>(data[3]),
+        .density_time = static_cast<int>(data[4]),
+        .density_min_neighbours = static_cast<int>(data[5])
+    });
+
+    sendResponse(data);
+
+}
+
+void ClusterThread::sendClusterFilterStats(const DataVec &data) {
+
+    if(data.size() != 0) {
+        sendError(ServerCommand::INVALID_COMMAND_DATA);
+        return;
+    }
+
+    // each counter is sent as two words, least significant first
+    DataVec response;
+    for(auto count : mClusterManager->getFilterStatistics()) {
+        response.push_back(count & 0xFFFFFFFF);
+        response.push_back(count >> 32);
+    }
+
+    sendResponse(response);
+
+}
+
+void ClusterThread::setClusterOutputFormat(const DataVec &data) {
+
+    // [0 = centroids only, 1 = centroid followed by a shape word]
+    if(data.size() != 1 || data[0] > 1) {
+        sendError(ServerCommand::INVALID_COMMAND_DATA);
+        return;
+    }
+
+    if(mClusterManager->setShapeOutput(data[0] == 1))
+        sendResponse(data);
+    else
+        sendError(ServerCommand::ERROR_OCCURED);
+
+}
@@ -1,124 +1,6 @@
 #include "server/ClusteringManager.h"
 
-#include <cmath>
-
-#include "server/CommsThread.h" // for htonll
-
-struct Packet {
-
-    std::uint64_t raw_value;
-
-    Packet(std::uint64_t val) :
-        raw_value(val) {}
-
-    int x() const { return (raw_value >> 56) & 0xFF; }
-    int y() const { return (raw_value >> 48) & 0xFF; }
-    std::int64_t t() const { return raw_value & 0x3FFFFFFFFF; }
-    int tot() const { return (raw_value >> 38) & 0x3FF; }
-
-};
-
-struct ClusterSettings {
-    int xy_sep;
-    int t_sep;
-    std::size_t max_t_separation = 20000;
-};
-
-struct Cluster {
-
-    static ClusterSettings settings;
-
-    double xmean, ymean, tmean, tot_total;
-    int xmin, xmax, ymin, ymax;
-    std::int64_t tmin, tmax;
-
-    Cluster(const Packet &p) :
-        xmean(p.x()),
-        ymean(p.y()),
-        tmean(p.t()),
-        tot_total(p.tot()),
-        xmin(p.x() - settings.xy_sep),
-        xmax(p.x() + settings.xy_sep),
-        ymin(p.y() - settings.xy_sep),
-        ymax(p.y() + settings.xy_sep),
-        tmin(p.t() - settings.t_sep),
-        tmax(p.t() + settings.t_sep) {}
-
-    void addClick(const Packet &p) {
-        xmean = (xmean * tot_total + p.x() * p.tot()) / (tot_total + p.tot());
-        ymean = (ymean * tot_total + p.y() * p.tot()) / (tot_total + p.tot());
-        tmean = (tmean * tot_total + p.t() * p.tot()) / (tot_total + p.tot());
-        tot_total += p.tot();
-        xmin = std::min(xmin, p.x() - settings.xy_sep);
-        xmax = std::max(xmax, p.x() + settings.xy_sep);
-        ymin = std::min(ymin, p.y() - settings.xy_sep);
-        ymax = std::max(ymax, p.y() + settings.xy_sep);
-        tmin = std::min(tmin, p.t() - settings.t_sep);
-        tmax = std::max(tmax, p.t() + settings.t_sep);
-    }
-
-    void addCluster(const Cluster &c) {
-        xmean = (xmean * tot_total + c.xmean * c.tot_total)/(tot_total + c.tot_total);
-        ymean = (ymean * tot_total + c.ymean * c.tot_total)/(tot_total + c.tot_total);
-        tmean = (tmean * tot_total + c.tmean * c.tot_total)/(tot_total + c.tot_total);
-        tot_total += c.tot_total;
-        xmin = std::min(xmin, c.xmin);
-        xmax = std::max(xmax, c.xmax);
-        ymin = std::min(ymin, c.ymin);
-        ymax = std::max(ymax, c.ymax);
-        tmin = std::min(tmin, c.tmin);
-        tmax = std::max(tmax, c.tmax);
-    }
-
-    std::uint64_t toRawValue() const {
-        std::uint64_t val = 0;
-        val |= ((static_cast<std::uint64_t>(xmean) & 0xFF) << 56);
-        val |= ((static_cast<std::uint64_t>(ymean) & 0xFF) << 48);
-        val |= (static_cast<std::uint64_t>(tmean) & 0x3FFFFFFFFF);
-        return val;
-    }
-
-    bool containsClick(const Packet &p) {
-        return (xmin <= p.x()) && (xmax >= p.x()) && (ymin <= p.y()) && (ymax >= p.y()) && (tmin <= p.t()) && (tmax >= p.t());
-    }
-
-};
-
-struct ClusterList {
-
-    std::vector<Cluster> list {};
-
-    void add(const Cluster &c) {
-        list.push_back(c);
-    }
-
-    Cluster& get(std::size_t ix) {
-        return list[ix];
-    }
-
-    void remove(std::size_t ix) {
-        if (list.size() > 1) {
-            std::iter_swap(list.begin() + ix, list.end() - 1);
-            list.pop_back();
-        } else {
-            list.clear();
-        }
-    }
-
-    std::size_t size() const {
-        return list.size();
-    }
-
-};
-
-// default cluster settings
-ClusterSettings Cluster::settings = {
-    .xy_sep = 5,
-    .t_sep = 20,
-    .max_t_separation = 50000
-};
-
-constexpr std::size_t INITIAL_ARRAY_SIZE = 10000;
+constexpr auto WATERMARK_TICK_PERIOD = std::chrono::milliseconds(10);
 
 ClusteringManager::ClusteringManager(ClusterThread &thread) :
     mThread(thread) {
@@ -126,9 +8,6 @@ ClusteringManager::ClusteringManager(ClusterThread &thread) :
     mPublishSocket = std::make_unique<zmq::socket_t>(thread.getZmq(), zmq::socket_type::pub);
     mPublishSocket->bind("tcp://*:*");
 
-    mOpenClusters = std::make_unique<ClusterList>();
-    mOpenClusters->list.reserve(INITIAL_ARRAY_SIZE);
-
 }
 
 ClusteringManager::~ClusteringManager() {
@@ -187,6 +66,8 @@ void ClusteringManager::poll() {
             handlePackets(packet_ptr, num_packets);
         }
 
+        flushExpired();
+
     } catch (...) {
 
         mThread.sendWarn("Error occured while handling packets in clustering thread");
@@ -199,11 +80,36 @@ void ClusteringManager::poll() {
 void ClusteringManager::flush() {
 
     std::vector<std::uint64_t> output;
+    mEngine.flush(output);
 
-    for(std::size_t cix = 0; cix < mOpenClusters->size(); ++cix) {
-        output.push_back(mOpenClusters->get(cix).toRawValue());
-    }
-    mOpenClusters->list.clear();
+    emitClusters(output);
+
+}
+
+void ClusteringManager::flushExpired() {
+
+    if(mFlushIdleMs <= 0 && mFlushStreamLag <= 0)
+        return;
+
+    auto now = std::chrono::steady_clock::now();
+    if(now - mLastWatermarkTick < WATERMARK_TICK_PERIOD)
+        return;
+    mLastWatermarkTick = now;
+
+    auto idle_deadline = (mFlushIdleMs > 0) ? now - std::chrono::milliseconds(mFlushIdleMs) : std::chrono::steady_clock::time_point::min();
+
+    std::vector<std::uint64_t> output;
+    mEngine.flushExpired(idle_deadline, mFlushStreamLag, output);
+
+    if(!output.empty())
+        emitClusters(output);
+
+}
+
+void ClusteringManager::emitClusters(const std::vector<std::uint64_t> &output) {
+
+    if(!output.empty() && mWriter.isOpen())
+        mWriter.write(output.data(), output.size());
 
     mPublishSocket->send(zmq::buffer(output), zmq::send_flags::dontwait);
 
@@ -216,77 +122,77 @@ void ClusteringManager::handlePackets(const std::uint64_t *data, std::size_t num
 
     std::vector<std::uint64_t> output;
 
-    for(std::size_t ix = 0; ix < num_packets; ++ix) {
-
-        Packet click = data[ix];
-
-        bool in_cluster = false;
-        Cluster *last_cluster = nullptr;
-
-        for(std::size_t cix = 0; cix < mOpenClusters->size(); ++cix) {
-            auto &cluster = mOpenClusters->get(cix);
-            if(cluster.containsClick(click)) {
-                cluster.addClick(click);
-                if(in_cluster) {
-                    last_cluster->addCluster(cluster);
-                    mOpenClusters->remove(cix);
-                } else {
-                    in_cluster = true;
-                    last_cluster = &cluster;
-                }
-            }
-        }
-
-        if(!in_cluster) {
-            mOpenClusters->add(click); // create new cluster
-        }
-
-        for(std::int64_t cix = mOpenClusters->size() - 1; cix >= 0; --cix) { // reverse iteration, so that we don't accidentally remove prior objects while iterating
-            auto &cluster = mOpenClusters->get(cix);
-            if(click.t() > cluster.tmax + Cluster::settings.max_t_separation) {
-                output.push_back(cluster.toRawValue());
-                mOpenClusters->remove(cix);
-            }
-        }
+    mEngine.addPackets(data, num_packets, output);
 
-    }
-
-    num_new_clusters += output.size();
+    num_new_clusters += output.size() / ClusterEngine::getWordsPerCluster(); // the shape word makes some formats two words long
 
     auto new_time = std::chrono::high_resolution_clock::now();
     if(std::chrono::duration_cast<std::chrono::milliseconds>(new_time - last_update_time).count() > 1000) {
-        mThread.sendLog("Clusters: [" + std::to_string(mReceivedChunks) +  "] " + std::to_string(num_new_clusters) + " clusters/s; " + std::to_string(mOpenClusters->size()) + " clusters are still in progress");
+        auto stats = mEngine.getFilterStatistics();
+        mThread.sendLog("Clusters: [" + std::to_string(mReceivedChunks) +  "] " + std::to_string(num_new_clusters) + " clusters/s; " + std::to_string(mEngine.getNumOpenClusters()) + " clusters are still in progress; "
+                        + std::to_string(stats[1 + ClusterEngine::REJECT_TOO_FEW_HITS]) + "/" + std::to_string(stats[1 + ClusterEngine::REJECT_TOT_TOO_LOW]) + "/"
+                        + std::to_string(stats[1 + ClusterEngine::REJECT_TOT_TOO_HIGH]) + "/" + std::to_string(stats[1 + ClusterEngine::REJECT_TOO_SPARSE]) + " rejected in total (size/low ToT/high ToT/density)");
         num_new_clusters = 0;
         mReceivedChunks = 0;
         last_update_time = new_time;
     }
 
-    if(!output.empty() && mFile) {
-        for(const auto &cluster : output) {
-            auto ordered_cluster = io::htonll(cluster); // fix byte order if necessary
-            mFile.write(reinterpret_cast<const char*>(&ordered_cluster), sizeof(ordered_cluster));
-        }
-        //DEBUG("Saved " + std::to_string(output.size()) + " clusters to file");
-    }
-
-    mPublishSocket->send(zmq::buffer(output), zmq::send_flags::dontwait);
+    emitClusters(output);
 
 }
 
 void ClusteringManager::setClusterParameters(int max_sep_xy, int max_sep_t, int max_t_sep) {
 
-    Cluster::settings.xy_sep = max_sep_xy;
-    Cluster::settings.t_sep = max_sep_t;
-    Cluster::settings.max_t_separation = max_t_sep;
+    ClusterEngine::setClusterParameters(max_sep_xy, max_sep_t, max_t_sep);
 
     DEBUG("Changed cluster parameters to [XY=" + std::to_string(max_sep_xy) + ", T=" + std::to_string(max_sep_t) + ", max separation=" + std::to_string(max_t_sep) + "]");
 
 }
 
+void ClusteringManager::setClusterFilters(const ClusterFilters &filters) {
+
+    mEngine.setFilters(filters);
+
+    DEBUG("Changed cluster filters to [min hits=" + std::to_string(filters.min_hits) + ", ToT=" + std::to_string(filters.min_tot) + "-" + std::to_string(filters.max_tot)
+          + ", density=" + std::to_string(filters.density_min_neighbours) + " hits within " + std::to_string(filters.density_radius) + " px/" + std::to_string(filters.density_time) + " ToA]");
+
+}
+
+std::array<std::uint64_t, ClusterEngine::NUM_REJECT_REASONS + 1> ClusteringManager::getFilterStatistics() const {
+
+    return mEngine.getFilterStatistics();
+
+}
+
+bool ClusteringManager::setShapeOutput(bool enabled) {
+
+    if(mWriter.isOpen() && mWriter.getWordsPerCluster() != (enabled ? 2 : 1)) {
+        mThread.sendWarn("Cannot change the cluster output format while a cluster file is being saved");
+        return false;
+    }
+
+    ClusterEngine::setShapeOutput(enabled);
+
+    DEBUG(std::string("Cluster shape output ") + (enabled ? "enabled" : "disabled"));
+
+    return true;
+
+}
+
+void ClusteringManager::setFlushWatermark(int idle_ms, std::int64_t stream_lag) {
+
+    mFlushIdleMs = idle_ms;
+    mFlushStreamLag = stream_lag;
+
+    DEBUG("Changed cluster flush watermark to [idle=" + std::to_string(idle_ms) + " ms, stream lag=" + std::to_string(stream_lag) + "]");
+
+}
+
 bool ClusteringManager::setSaveFile(const std::string &path) {
 
-    if(mFile.is_open()) {
-        mFile.close();
+    if(mWriter.isOpen()) {
+        DEBUG("Closing cluster file after " + std::to_string(mWriter.getNumClusters()) + " clusters");
+        mWriter.close();
     }
 
     if(path.empty()) {
@@ -294,16 +200,7 @@ bool ClusteringManager::setSaveFile(const std::string &path) {
         return true;
     }
 
-    bool success = true;
-
-    try {
-        mFile.open(path, std::ios_base::out | std::ios_base::binary);
-        mFile << "CLUSTERS"; // header, and 8 reserved bytes to store the size
-    } catch (...) {
-        success = false;
-    }
-
-    success &= mFile.is_open();
+    bool success = mWriter.open(path, ClusterEngine::getWordsPerCluster());
     if(!success){
         DEBUG("Error opening file at " + path);
         return false;
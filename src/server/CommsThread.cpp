@@ -53,9 +53,7 @@ void CommsThread::execute() {
 
         try {
             mTpxManager->poll();
-
-            if(!mTpxManager->isExecutingCommand())
-                mClientManager->poll();
+            mClientManager->poll(); // detector commands are queued, so clients are served while one is in flight
         } catch (asio::system_error &ex) {
             emit err("A network error occurred while communicating with the Timepix (errcode=" + std::to_string(ex.code().value()) + ")");
             emit err(ex.what());
@@ -96,6 +94,8 @@ void CommsThread::execute() {
     }
     if(mHistogramCommandSocket)
         mHistogramCommandSocket->close();
+    if(mHistogramScanSocket)
+        mHistogramScanSocket->close();
 
     DEBUG("TCP thread terminated");
 
@@ -154,6 +154,7 @@ void CommsThread::startHistogramThread() {
 
     mHistogramThread = new HistogramThread(*this);
     mHistogramCommandSocket = mHistogramThread->getCommandClient();
+    mHistogramScanSocket = mHistogramThread->getCommandClient();
     QThreadPool::globalInstance()->start(mHistogramThread);
 
 }
@@ -181,3 +182,9 @@ zmq::socket_t* CommsThread::getHistogramThreadSocket() {
     return mHistogramCommandSocket.get();
 
 }
+
+zmq::socket_t* CommsThread::getHistogramScanSocket() {
+
+    return mHistogramScanSocket.get();
+
+}
@@ -0,0 +1,121 @@
+#include "server/Equalizer.h"
+
+#include <algorithm>
+#include <cmath>
+
+bool EqualizationSettings::fromConfigWords(const DataVec &words) {
+
+    if(words.size() != CONFIG_WORDS)
+        return false;
+
+    noise_counts = words.back();
+    return scan.fromConfigWords(DataVec(words.begin(), words.end() - 1));
+
+}
+
+NoiseEdgeFinder::NoiseEdgeFinder(std::uint32_t noise_counts) :
+    mNoiseCounts(noise_counts),
+    mEdges(Equalizer::NUM_PIXELS, NO_EDGE) {
+
+    // do nothing
+
+}
+
+void NoiseEdgeFinder::addStep(std::uint32_t value, const DataVec &image) {
+
+    if(image.size() != mEdges.size())
+        return;
+
+    // branch-free, so that the compiler can vectorise the pass over the image
+    auto step_value = static_cast<std::int32_t>(value);
+    for(std::size_t px = 0; px < mEdges.size(); ++px)
+        mEdges[px] = (mEdges[px] == NO_EDGE && image[px] > mNoiseCounts) ? step_value : mEdges[px];
+
+}
+
+const std::vector<std::int32_t>& NoiseEdgeFinder::getEdges() const {
+
+    return mEdges;
+
+}
+
+std::uint8_t Equalizer::getPixelConfig(std::uint8_t trim, bool masked) {
+
+    return (std::min(trim, MAX_TRIM) << TRIM_SHIFT) | (masked ? MASK_BIT : 0);
+
+}
+
+DataVec Equalizer::packPixelConfig(const std::vector<std::uint8_t> &pixels) {
+
+    constexpr std::size_t COLUMN_WORDS = 48;
+    DataVec matrix(256 * COLUMN_WORDS, 0);
+
+    for(std::size_t x = 0; x < 256; ++x) {
+        auto *column = &matrix[x * COLUMN_WORDS];
+        for(std::size_t y = 0; y < 256; ++y) {
+            std::uint64_t bits = pixels[x + 256*y] & 0x3F;
+            auto bit = 6*y;
+            column[bit / 32] |= static_cast<std::uint32_t>(bits << (bit % 32));
+            if(bit % 32 > 26) // the pixel straddles two words
+                column[bit / 32 + 1] |= static_cast<std::uint32_t>(bits >> (32 - bit % 32));
+        }
+    }
+
+    return matrix;
+
+}
+
+void Equalizer::compute(const std::vector<std::int32_t> &edges_trim0, const std::vector<std::int32_t> &edges_trim15) {
+
+    // the target and the shift per trim step come from the pixels with both edges
+    double sum_edges = 0;
+    double sum_shift = 0;
+    std::size_t num_good = 0;
+    for(std::size_t px = 0; px < NUM_PIXELS; ++px) {
+        if(edges_trim0[px] == NoiseEdgeFinder::NO_EDGE || edges_trim15[px] == NoiseEdgeFinder::NO_EDGE)
+            continue;
+        sum_edges += edges_trim0[px] + edges_trim15[px];
+        sum_shift += edges_trim15[px] - edges_trim0[px];
+        ++num_good;
+    }
+
+    double target = num_good ? sum_edges / (2 * num_good) : 0;
+    double shift_per_trim = num_good ? sum_shift / (num_good * MAX_TRIM) : 0;
+
+    mNumMasked = 0;
+    for(std::size_t px = 0; px < NUM_PIXELS; ++px) {
+        bool good = shift_per_trim != 0 && edges_trim0[px] != NoiseEdgeFinder::NO_EDGE && edges_trim15[px] != NoiseEdgeFinder::NO_EDGE;
+        mMasked[px] = !good;
+        if(!good) {
+            mTrims[px] = 0;
+            ++mNumMasked;
+            continue;
+        }
+
+        auto trim = std::lround((target - edges_trim0[px]) / shift_per_trim);
+        mTrims[px] = static_cast<std::uint8_t>(std::clamp<long>(trim, 0, MAX_TRIM));
+    }
+
+}
+
+const std::vector<std::uint8_t>& Equalizer::getTrims() const {
+
+    return mTrims;
+
+}
+
+std::size_t Equalizer::getNumMasked() const {
+
+    return mNumMasked;
+
+}
+
+DataVec Equalizer::getPixelConfig() const {
+
+    std::vector<std::uint8_t> pixels(NUM_PIXELS);
+    for(std::size_t px = 0; px < NUM_PIXELS; ++px)
+        pixels[px] = getPixelConfig(mTrims[px], mMasked[px]);
+
+    return packPixelConfig(pixels);
+
+}
@@ -0,0 +1,114 @@
+#include "server/FrameStack.h"
+
+#include <algorithm>
+
+constexpr std::uint64_t TOA_MASK = 0x3FFFFFFFFF;
+constexpr std::size_t MAX_SPARE_FRAMES = 16;
+constexpr std::uint64_t TOA_RESET_JUMP = static_cast<std::uint64_t>(1) << 36; // a backwards jump this large means the rollover counter was reset
+
+void FrameStack::setFrameLength(std::uint64_t frame_length, std::uint64_t tolerance) {
+
+    mFrameLength = frame_length;
+    mTolerance = tolerance;
+
+    mOpenFrames.clear();
+    mSpareFrames.clear();
+    mStarted = false;
+    mNumLateHits = 0;
+
+}
+
+bool FrameStack::isEnabled() const {
+
+    return mFrameLength != 0;
+
+}
+
+std::uint64_t FrameStack::getFrameLength() const {
+
+    return mFrameLength;
+
+}
+
+void FrameStack::addPackets(const std::uint64_t *data, std::size_t num_packets, const FrameCallback &callback) {
+
+    if(!isEnabled())
+        return;
+
+    for(std::size_t ix = 0; ix < num_packets; ++ix) {
+
+        auto packet = data[ix];
+        auto toa = packet & TOA_MASK;
+        auto frame = toa / mFrameLength;
+
+        if(!mStarted || (toa + TOA_RESET_JUMP < mLatestToA)) {
+            flush(callback);
+            mFirstOpenFrame = frame;
+            mLatestToA = toa;
+            mStarted = true;
+        }
+
+        if(frame < mFirstOpenFrame) {
+            ++mNumLateHits;
+            continue;
+        }
+
+        if(toa > mLatestToA) {
+            mLatestToA = toa;
+            // every frame ending at least the tolerance before the latest hit is complete
+            auto settled = mLatestToA > mTolerance ? (mLatestToA - mTolerance) / mFrameLength : 0;
+            if(settled > mFirstOpenFrame)
+                finishFrames(settled, callback);
+        }
+
+        auto slot = frame - mFirstOpenFrame;
+        if(slot >= MAX_OPEN_FRAMES) {
+            flush(callback);
+            mFirstOpenFrame = frame;
+            slot = 0;
+        }
+
+        while(mOpenFrames.size() <= slot) {
+            if(mSpareFrames.empty()) {
+                mOpenFrames.emplace_back(NUM_PIXELS, 0);
+            } else {
+                mOpenFrames.push_back(std::move(mSpareFrames.back()));
+                mSpareFrames.pop_back();
+            }
+        }
+
+        ++mOpenFrames[slot][((packet >> 56) & 0xFF) + ((packet >> 48) & 0xFF)*256];
+
+    }
+
+}
+
+void FrameStack::flush(const FrameCallback &callback) {
+
+    finishFrames(mFirstOpenFrame + mOpenFrames.size(), callback);
+
+}
+
+void FrameStack::finishFrames(std::uint64_t end_frame, const FrameCallback &callback) {
+
+    while(mFirstOpenFrame < end_frame && !mOpenFrames.empty()) {
+        auto &frame = mOpenFrames.front();
+        callback(mFirstOpenFrame, frame);
+        if(mSpareFrames.size() < MAX_SPARE_FRAMES) {
+            std::fill(frame.begin(), frame.end(), 0);
+            mSpareFrames.push_back(std::move(frame));
+        }
+        mOpenFrames.pop_front();
+        ++mFirstOpenFrame;
+    }
+
+    // settled frames past the last open one never received a hit and are skipped; clients see a gap in the indices
+    mFirstOpenFrame = std::max(mFirstOpenFrame, end_frame);
+
+}
+
+std::uint64_t FrameStack::getNumLateHits() const {
+
+    return mNumLateHits;
+
+}
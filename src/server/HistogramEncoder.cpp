@@ -0,0 +1,164 @@
+#include "server/HistogramEncoder.h"
+
+#include <algorithm>
+#include <cstring>
+
+// counts the runs of selected pixels and how many pixels they cover
+template<typename Selector>
+std::pair<std::size_t, std::size_t> countRuns(std::size_t num_pixels, Selector selected) {
+
+    std::size_t num_runs = 0;
+    std::size_t num_values = 0;
+    bool in_run = false;
+
+    for(std::size_t ix = 0; ix < num_pixels; ++ix) {
+        bool sel = selected(ix);
+        num_values += sel;
+        num_runs += sel && !in_run;
+        in_run = sel;
+    }
+
+    return {num_runs, num_values};
+
+}
+
+HistogramEncoder::HistogramEncoder(std::size_t num_pixels) :
+    mCurrent(num_pixels, 0),
+    mPrevious(num_pixels, 0),
+    mHeader(HEADER_WORDS, 0) {
+
+    // do nothing
+
+}
+
+void HistogramEncoder::setCounterWidth(int bits) {
+
+    mCounterWidth = bits;
+    reset();
+
+}
+
+void HistogramEncoder::setAutomatic(bool automatic) {
+
+    mAutomatic = automatic;
+    reset();
+
+}
+
+void HistogramEncoder::reset() {
+
+    mFramesSinceKeyframe = KEYFRAME_INTERVAL;
+
+}
+
+void HistogramEncoder::encode(const std::vector<std::uint64_t> &counts) {
+
+    std::uint64_t max_count = mCounterWidth >= 64 ? ~static_cast<std::uint64_t>(0) : (static_cast<std::uint64_t>(1) << mCounterWidth) - 1;
+    const auto num_pixels = mCurrent.size();
+    for(std::size_t ix = 0; ix < num_pixels; ++ix)
+        mCurrent[ix] = std::min(counts[ix], max_count);
+
+    auto encoding = HistogramEncoding::DENSE;
+    std::size_t num_runs = 0;
+    std::size_t num_values = num_pixels;
+
+    if(mAutomatic) {
+
+        std::size_t counter_bytes = mCounterWidth / 8;
+        std::size_t best_bytes = num_pixels * counter_bytes;
+
+        auto [sparse_runs, sparse_values] = countRuns(num_pixels, [this](std::size_t ix) { return mCurrent[ix] != 0; });
+        std::size_t sparse_bytes = sparse_runs*4 + sparse_values*counter_bytes;
+        if(sparse_bytes < best_bytes) {
+            encoding = HistogramEncoding::SPARSE;
+            num_runs = sparse_runs;
+            num_values = sparse_values;
+            best_bytes = sparse_bytes;
+        }
+
+        if(mFramesSinceKeyframe < KEYFRAME_INTERVAL) {
+            auto [delta_runs, delta_values] = countRuns(num_pixels, [this](std::size_t ix) { return mCurrent[ix] != mPrevious[ix]; });
+            std::size_t delta_bytes = delta_runs*4 + delta_values*counter_bytes;
+            if(delta_bytes < best_bytes) {
+                encoding = HistogramEncoding::DELTA;
+                num_runs = delta_runs;
+                num_values = delta_values;
+            }
+        }
+
+    }
+
+    switch(mCounterWidth) {
+    case 64:
+        writePayload<std::uint64_t>(encoding, num_runs, num_values);
+        break;
+    case 32:
+        writePayload<std::uint32_t>(encoding, num_runs, num_values);
+        break;
+    default:
+        writePayload<std::uint16_t>(encoding, num_runs, num_values);
+        break;
+    }
+
+    mHeader[0] = VERSION;
+    mHeader[1] = static_cast<std::uint32_t>(encoding);
+    mHeader[2] = mCounterWidth;
+    mHeader[3] = mSequence;
+    mHeader[4] = encoding == HistogramEncoding::DELTA ? mSequence - 1 : mSequence;
+    mHeader[5] = static_cast<std::uint32_t>(num_runs);
+    mHeader[6] = static_cast<std::uint32_t>(num_values);
+
+    ++mSequence;
+    mFramesSinceKeyframe = (encoding == HistogramEncoding::DELTA) ? mFramesSinceKeyframe + 1 : 1;
+    std::swap(mCurrent, mPrevious);
+
+}
+
+template<typename Counter>
+void HistogramEncoder::writePayload(HistogramEncoding encoding, std::size_t num_runs, std::size_t num_values) {
+
+    mPayload.resize(num_runs*4 + num_values*sizeof(Counter));
+
+    const auto num_pixels = mCurrent.size();
+
+    if(encoding == HistogramEncoding::DENSE) {
+        auto *out = reinterpret_cast<Counter*>(mPayload.data());
+        for(std::size_t ix = 0; ix < num_pixels; ++ix)
+            out[ix] = static_cast<Counter>(mCurrent[ix]);
+        return;
+    }
+
+    auto *runs = reinterpret_cast<std::uint32_t*>(mPayload.data());
+    auto *values = mPayload.data() + num_runs*4; // not necessarily aligned for Counter, so written with memcpy
+    bool delta = (encoding == HistogramEncoding::DELTA);
+
+    std::size_t run_start = 0;
+    bool in_run = false;
+
+    for(std::size_t ix = 0; ix <= num_pixels; ++ix) {
+        bool sel = ix < num_pixels && (delta ? mCurrent[ix] != mPrevious[ix] : mCurrent[ix] != 0);
+        if(sel) {
+            auto value = static_cast<Counter>(mCurrent[ix]);
+            std::memcpy(values, &value, sizeof(Counter));
+            values += sizeof(Counter);
+            if(!in_run)
+                run_start = ix;
+        } else if(in_run) {
+            *runs++ = static_cast<std::uint32_t>(run_start | ((ix - run_start - 1) << 16));
+        }
+        in_run = sel;
+    }
+
+}
+
+const std::vector<std::uint32_t>& HistogramEncoder::getHeader() const {
+
+    return mHeader;
+
+}
+
+const std::vector<std::uint8_t>& HistogramEncoder::getPayload() const {
+
+    return mPayload;
+
+}
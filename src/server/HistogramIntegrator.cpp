@@ -0,0 +1,102 @@
+#include "server/HistogramIntegrator.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+constexpr std::size_t NUM_PIXELS = 256*256;
+
+HistogramIntegrator::HistogramIntegrator() :
+    mImage(NUM_PIXELS, 0) {
+
+    // do nothing
+
+}
+
+bool HistogramIntegrator::setMode(HistogramMode mode, std::uint32_t parameter) {
+
+    switch(mode) {
+    case HistogramMode::PER_PERIOD:
+    case HistogramMode::CUMULATIVE:
+        break;
+
+    case HistogramMode::SLIDING:
+        if(parameter < 1 || parameter > MAX_SLIDING_PERIODS)
+            return false;
+        mSlidingPeriods = parameter;
+        break;
+
+    case HistogramMode::DECAYING:
+        if(parameter >= DECAY_SCALE)
+            return false;
+        mRetention = static_cast<double>(parameter) / DECAY_SCALE;
+        break;
+
+    default:
+        return false;
+    }
+
+    mMode = mode;
+    reset();
+
+    return true;
+
+}
+
+void HistogramIntegrator::reset() {
+
+    std::fill(mImage.begin(), mImage.end(), 0);
+
+    mRing.clear();
+    mRingPos = 0;
+    if(mMode == HistogramMode::SLIDING)
+        mRing.assign(mSlidingPeriods, std::vector<std::uint32_t>(NUM_PIXELS, 0));
+
+    mDecayed.clear();
+    if(mMode == HistogramMode::DECAYING)
+        mDecayed.assign(NUM_PIXELS, 0.0);
+
+}
+
+const std::vector<std::uint64_t>& HistogramIntegrator::integrate(const std::vector<std::uint64_t> &period_counts) {
+
+    switch(mMode) {
+    case HistogramMode::PER_PERIOD:
+        std::copy(period_counts.begin(), period_counts.end(), mImage.begin());
+        break;
+
+    case HistogramMode::CUMULATIVE:
+        for(std::size_t ix = 0; ix < NUM_PIXELS; ++ix)
+            mImage[ix] += period_counts[ix];
+        break;
+
+    case HistogramMode::SLIDING: {
+        // the window sum is kept up to date by swapping the oldest period for the newest one
+        constexpr std::uint64_t max_count = std::numeric_limits<std::uint32_t>::max();
+        auto &oldest = mRing[mRingPos];
+        for(std::size_t ix = 0; ix < NUM_PIXELS; ++ix) {
+            auto count = static_cast<std::uint32_t>(std::min(period_counts[ix], max_count));
+            mImage[ix] = mImage[ix] - oldest[ix] + count;
+            oldest[ix] = count;
+        }
+        mRingPos = (mRingPos + 1) % mRing.size();
+        break;
+    }
+
+    case HistogramMode::DECAYING:
+        for(std::size_t ix = 0; ix < NUM_PIXELS; ++ix) {
+            mDecayed[ix] = mDecayed[ix]*mRetention + static_cast<double>(period_counts[ix]);
+            mImage[ix] = static_cast<std::uint64_t>(std::llround(mDecayed[ix]));
+        }
+        break;
+    }
+
+    return mImage;
+
+}
+
+const std::vector<std::uint64_t>& HistogramIntegrator::getImage() const {
+
+    return mImage;
+
+}
@@ -1,18 +1,35 @@
 #include "server/HistogramManager.h"
 
+#include <algorithm>
+#include <limits>
+
+constexpr std::size_t DEFAULT_WORKER_THREADS = 2;
+constexpr std::uint32_t TOF_FRAME_VERSION = 1;
+constexpr std::size_t TOF_HEADER_WORDS = 4;
+constexpr std::uint32_t ROI_FRAME_VERSION = 1;
+constexpr std::size_t ROI_HEADER_WORDS = 4;
+constexpr std::uint32_t FRAME_VERSION = 1;
+
 HistogramManager::HistogramManager(HistogramThread &thread) :
     mThread(thread) {
 
     mPublishSocket = std::make_unique<zmq::socket_t>(thread.getZmq(), zmq::socket_type::pub);
     mPublishSocket->bind("tcp://*:*");
 
-    std::fill(mHistogram.begin(), mHistogram.end(), 0);
+    mProducts.emplace_back();
+    mFrameEncoder.setAutomatic(true); // the frame topic has always carried sparse and delta frames
+    setNumThreads(DEFAULT_WORKER_THREADS);
+    resetAccumulators();
+
     mLastOutputTime = std::chrono::high_resolution_clock::now();
+    mLastRoiTime = mLastOutputTime;
 
 }
 
 HistogramManager::~HistogramManager() {
 
+    mWorkers.reset(); // joins the worker threads before the partials are destroyed
+
     if(mInputSocket)
         mInputSocket->close();
 
@@ -60,16 +77,28 @@ void HistogramManager::poll() {
         if(has_msg && msg.size() != 0) {
             auto num_packets = msg.size() / 8;
             auto packet_ptr = reinterpret_cast<const std::uint64_t*>(msg.data());
-            handlePackets(packet_ptr, num_packets);
+            mWorkers->submit(std::vector<std::uint64_t>(packet_ptr, packet_ptr + num_packets));
+
+            if(mFrameStack.isEnabled()) {
+                mFrameStack.addPackets(packet_ptr, num_packets, [this](std::uint64_t frame_index, const std::vector<std::uint32_t> &counts) {
+                    emitFrame(frame_index, counts);
+                });
+            }
 
             auto new_time = std::chrono::high_resolution_clock::now();
             if(std::chrono::duration_cast<std::chrono::milliseconds>(new_time - mLastOutputTime).count() >= mOutputPeriod) {
-                mPublishSocket->send(zmq::buffer(mHistogram), zmq::send_flags::dontwait);
-                std::fill(mHistogram.begin(), mHistogram.end(), 0); // reset histogram
+                publish();
                 mLastOutputTime = new_time;
             }
         }
 
+        // ROI counts run on their own (usually much faster) tick, and are sent even when no hits arrived
+        if(mRoiTable) {
+            auto new_time = std::chrono::high_resolution_clock::now();
+            if(std::chrono::duration_cast<std::chrono::milliseconds>(new_time - mLastRoiTime).count() >= mRoiPeriod)
+                publishRoiCounts();
+        }
+
     } catch (...) {
 
         mThread.sendWarn("Error occured while handling data in histogram thread");
@@ -86,17 +115,537 @@ void HistogramManager::setOutputPeriod(int period_ms) {
 
 }
 
-void HistogramManager::handlePackets(const std::uint64_t *data, std::size_t num_packets) {
+bool HistogramManager::setCounterWidth(int bits) {
 
-    for(std::size_t ix = 0; ix < num_packets; ++ix) {
+    if(bits != 16 && bits != 32 && bits != 64)
+        return false;
 
-        auto packet = data[ix];
-        auto x = (packet >> 56) & 0xFF;
-        auto y = (packet >> 48) & 0xFF;
+    mThread.sendLog("Setting histogram counter width to " + std::to_string(bits) + " bits");
+    mCounterWidth = bits;
+    for(auto &levels : mEncoders)
+        for(auto &encoder : levels)
+            encoder.setCounterWidth(bits);
 
-        std::size_t hist_ix = x + y*256;
-        ++mHistogram[hist_ix];
+    return true;
+
+}
+
+void HistogramManager::setNumThreads(std::size_t num_threads) {
+
+    if(mWorkers)
+        mWorkers->drain();
+
+    // fold anything accumulated so far into the totals, so that changing the thread count loses no counts
+    for(auto &shard : mPartials)
+        for(std::size_t p = 0; p < shard.size(); ++p)
+            shard[p].addTo(mHistograms[p]);
+    for(auto &tof : mTofPartials)
+        tof.addTo(mTofSpectrum);
+    for(auto &roi : mRoiPartials)
+        roi.collectInto(mRoiCounts);
+
+    mWorkers.reset();
+    mPartials.clear();
+    mPartials.resize(std::max<std::size_t>(num_threads, 1));
+    for(auto &shard : mPartials)
+        shard.resize(mProducts.size());
+    mHistograms.resize(mProducts.size(), std::vector<std::uint64_t>(HistogramAccumulator<std::uint32_t>::NUM_PIXELS, 0));
+    mTofPartials.resize(mPartials.size());
+    for(auto &tof : mTofPartials)
+        tof.setSettings(mTofSettings);
+    mTofSpectrum.resize(mTofSettings.num_bins, 0);
+    mRoiPartials.resize(mPartials.size());
+    for(auto &roi : mRoiPartials)
+        roi.setTable(mRoiTable);
+    mVolumeIndices.resize(mPartials.size());
+    mTotCubeIndices.resize(mPartials.size());
+
+    mWorkers = std::make_unique<PacketWorkerPool>(num_threads, [this](std::size_t shard, const std::uint64_t *data, std::size_t num_packets) {
+        handlePackets(shard, data, num_packets);
+    });
+
+    DEBUG("Histogram accumulation is using " + std::to_string(num_threads) + " worker threads");
+
+}
 
+void HistogramManager::handlePackets(std::size_t shard, const std::uint64_t *data, std::size_t num_packets) {
+
+    fillProducts(mProducts, mPartials[shard], data, num_packets);
+    mTofPartials[shard].addPackets(data, num_packets);
+    mRoiPartials[shard].addPackets(data, num_packets);
+
+    if(mVolume.getSettings().tof.isEnabled()) {
+        auto &indices = mVolumeIndices[shard];
+        mVolume.computeIndices(data, num_packets, indices);
+        mVolume.addIndices(indices);
+    }
+
+    if(mTotCube.isEnabled()) {
+        auto &indices = mTotCubeIndices[shard];
+        mTotCube.computeIndices(data, num_packets, indices);
+        mTotCube.addIndices(indices);
     }
 
 }
+
+void HistogramManager::setProducts(const std::vector<HistogramProduct> &products) {
+
+    mWorkers->drain();
+
+    mProducts = products;
+    mDefaultProducts = mProducts.empty();
+    if(mDefaultProducts)
+        mProducts.emplace_back();
+    mScanGateOpen = false; // its product may no longer exist
+
+    // partial images of the old products can't be carried over, so the current period starts again
+    resetAccumulators();
+    mLastOutputTime = std::chrono::high_resolution_clock::now();
+
+    mThread.sendLog("Histogram server is filling " + std::to_string(mProducts.size()) + " products");
+
+}
+
+void HistogramManager::resetAccumulators() {
+
+    for(auto &shard : mPartials) {
+        shard.clear();
+        shard.resize(mProducts.size());
+    }
+
+    mHistograms.assign(mProducts.size(), std::vector<std::uint64_t>(HistogramAccumulator<std::uint32_t>::NUM_PIXELS, 0));
+
+    for(auto &tof : mTofPartials)
+        tof.clear();
+    mTofSpectrum.assign(mTofSettings.num_bins, 0);
+
+    for(auto &roi : mRoiPartials)
+        roi.clear();
+    std::fill(mRoiCounts.begin(), mRoiCounts.end(), 0);
+
+    mIntegrators.clear();
+    mIntegrators.resize(mProducts.size());
+    for(auto &integrator : mIntegrators)
+        integrator.setMode(mMode, mModeParameter);
+
+    mPyramids.clear();
+    mPyramids.resize(mProducts.size());
+
+    mEncoders.clear();
+    mEncoders.resize(mProducts.size());
+    for(auto &levels : mEncoders) {
+        for(int level = 0; level < HistogramPyramid::NUM_LEVELS; ++level) {
+            auto width = HistogramPyramid::getWidth(level);
+            auto &encoder = levels.emplace_back(width * width);
+            encoder.setCounterWidth(mCounterWidth);
+            encoder.setAutomatic(mAutomaticEncoding);
+        }
+    }
+
+}
+
+bool HistogramManager::setMode(HistogramMode mode, std::uint32_t parameter) {
+
+    HistogramIntegrator test;
+    if(!test.setMode(mode, parameter))
+        return false;
+
+    mThread.sendLog("Setting histogram mode to " + std::to_string(static_cast<std::uint32_t>(mode))
+                    + " with parameter " + std::to_string(parameter));
+    mMode = mode;
+    mModeParameter = parameter;
+    reset();
+
+    return true;
+
+}
+
+void HistogramManager::reset() {
+
+    mWorkers->drain();
+    resetAccumulators();
+    mVolume.clear();
+    mTotCube.clear();
+    mLastOutputTime = std::chrono::high_resolution_clock::now();
+
+}
+
+const std::vector<std::uint64_t>* HistogramManager::getImage(std::size_t product) const {
+
+    if(product >= mIntegrators.size())
+        return nullptr;
+
+    return &mIntegrators[product].getImage();
+
+}
+
+void HistogramManager::setTofSettings(const TofSettings &settings) {
+
+    mWorkers->drain();
+
+    mTofSettings = settings;
+    for(auto &tof : mTofPartials)
+        tof.setSettings(settings);
+    mTofSpectrum.assign(settings.num_bins, 0);
+
+    if(settings.isEnabled())
+        mThread.sendLog("Histogram server is filling a " + std::to_string(settings.num_bins) + " bin ToF spectrum");
+    else
+        mThread.sendLog("Histogram server ToF spectrum disabled");
+
+}
+
+void HistogramManager::setRoiTable(std::shared_ptr<const RoiTable> table) {
+
+    mWorkers->drain();
+
+    if(table && table->num_rois == 0)
+        table.reset();
+
+    mRoiTable = table;
+    for(auto &roi : mRoiPartials)
+        roi.setTable(table);
+    mRoiCounts.assign(table ? table->num_rois : 0, 0);
+    mLastRoiTime = std::chrono::high_resolution_clock::now();
+
+    if(table)
+        mThread.sendLog("Histogram server is counting hits in " + std::to_string(table->num_rois) + " regions of interest");
+    else
+        mThread.sendLog("Histogram server ROI counters disabled");
+
+}
+
+void HistogramManager::setRoiPeriod(int period_ms) {
+
+    mThread.sendLog("Setting ROI output period to " + std::to_string(period_ms));
+    mRoiPeriod = period_ms;
+
+}
+
+void HistogramManager::setVolumeSettings(const VolumeSettings &settings) {
+
+    mWorkers->drain();
+    mVolume.setSettings(settings);
+
+    if(settings.tof.isEnabled())
+        mThread.sendLog("Histogram server is filling a " + std::to_string(settings.getWidth()) + "x" + std::to_string(settings.getWidth())
+                        + "x" + std::to_string(settings.tof.num_bins) + " volume");
+    else
+        mThread.sendLog("Histogram server volume disabled");
+
+}
+
+bool HistogramManager::getVolumeSlice(std::size_t tof_start, std::size_t tof_end, std::vector<std::uint64_t> &output) {
+
+    mWorkers->drain();
+    return mVolume.getSlice(tof_start, tof_end, output);
+
+}
+
+bool HistogramManager::getVolumeProjection(VolumeAccumulator::ProjectionAxis axis, std::vector<std::uint64_t> &output) {
+
+    mWorkers->drain();
+    return mVolume.getProjection(axis, output);
+
+}
+
+bool HistogramManager::setTotCubeBins(std::uint32_t num_bins, std::uint32_t bin_width) {
+
+    mWorkers->drain();
+    if(!mTotCube.setBins(num_bins, bin_width))
+        return false;
+
+    if(num_bins != 0)
+        mThread.sendLog("Histogram server is filling per-pixel ToT spectra with " + std::to_string(num_bins) + " bins");
+    else
+        mThread.sendLog("Histogram server per-pixel ToT spectra disabled");
+
+    return true;
+
+}
+
+bool HistogramManager::getTotCubePixels(std::size_t first_pixel, std::size_t num_pixels, std::vector<std::uint32_t> &output) {
+
+    mWorkers->drain();
+    return mTotCube.getPixels(first_pixel, num_pixels, output);
+
+}
+
+bool HistogramManager::saveTotCube(const std::string &path) {
+
+    mWorkers->drain();
+    if(!mTotCube.save(path)) {
+        mThread.sendWarn("Unable to save per-pixel ToT spectra to " + path);
+        return false;
+    }
+
+    mThread.sendLog("Saved per-pixel ToT spectra to " + path);
+    return true;
+
+}
+
+void HistogramManager::setFrameStack(std::uint64_t frame_length, std::uint64_t tolerance) {
+
+    // frames that are still open go out before the settings change
+    mFrameStack.flush([this](std::uint64_t frame_index, const std::vector<std::uint32_t> &counts) {
+        emitFrame(frame_index, counts);
+    });
+
+    mFrameStack.setFrameLength(frame_length, tolerance);
+    mFrameEncoder.reset();
+
+    if(mFrameFile.isOpen()) {
+        mThread.sendLog("Closing the frame file, as its frame length no longer applies");
+        mFrameFile.close();
+    }
+
+    if(frame_length != 0)
+        mThread.sendLog("Histogram server is publishing frames of " + std::to_string(frame_length) + " ToA units");
+    else
+        mThread.sendLog("Histogram server frame stack disabled");
+
+}
+
+bool HistogramManager::setFrameFile(const std::string &path, std::uint64_t capacity) {
+
+    mFrameFile.close();
+
+    if(path == "")
+        return true;
+
+    // the file's header records the frame length, so there has to be one
+    if(!mFrameStack.isEnabled()) {
+        mThread.sendWarn("Unable to write frames to " + path + " before the frame stack is set up");
+        return false;
+    }
+
+    if(!mFrameFile.open(path, mFrameStack.getFrameLength(), capacity)) {
+        mThread.sendWarn("Unable to open frame file " + path);
+        return false;
+    }
+
+    mThread.sendLog("Writing up to " + std::to_string(capacity) + " frames to " + path);
+    return true;
+
+}
+
+void HistogramManager::emitFrame(std::uint64_t frame_index, const std::vector<std::uint32_t> &counts) {
+
+    mFrameFile.write(frame_index, counts);
+
+    mFrameCounts.assign(counts.begin(), counts.end());
+    mFrameEncoder.encode(mFrameCounts);
+
+    // sent as [topic]["version, frame index (2 words), late hits so far"][image header][image]
+    auto late_hits = mFrameStack.getNumLateHits();
+    mFrameHeader = {
+        FRAME_VERSION,
+        static_cast<std::uint32_t>(frame_index),
+        static_cast<std::uint32_t>(frame_index >> 32),
+        static_cast<std::uint32_t>(std::min<std::uint64_t>(late_hits, std::numeric_limits<std::uint32_t>::max()))
+    };
+
+    mPublishSocket->send(zmq::buffer(std::string("frame")), zmq::send_flags::sndmore | zmq::send_flags::dontwait);
+    mPublishSocket->send(zmq::buffer(mFrameHeader), zmq::send_flags::sndmore | zmq::send_flags::dontwait);
+    mPublishSocket->send(zmq::buffer(mFrameEncoder.getHeader()), zmq::send_flags::sndmore | zmq::send_flags::dontwait);
+    mPublishSocket->send(zmq::buffer(mFrameEncoder.getPayload()), zmq::send_flags::dontwait);
+
+}
+
+void HistogramManager::setAutomaticEncoding(bool automatic) {
+
+    mThread.sendLog(automatic ? "Histogram frames will use the smallest encoding" : "Histogram frames will be sent dense");
+    mAutomaticEncoding = automatic;
+    for(auto &levels : mEncoders)
+        for(auto &encoder : levels)
+            encoder.setAutomatic(automatic);
+
+}
+
+void HistogramManager::setPyramidOutput(bool enabled) {
+
+    mThread.sendLog(enabled ? "Histogram server is publishing binned images" : "Histogram server is publishing full images only");
+    mPublishPyramid = enabled;
+    for(auto &levels : mEncoders)
+        for(auto &encoder : levels)
+            encoder.reset(); // a level that was switched off has no base for a delta
+
+}
+
+bool HistogramManager::getRegion(std::size_t product, int level, std::size_t x0, std::size_t y0, std::size_t x1, std::size_t y1,
+                                 std::vector<std::uint64_t> &output) {
+
+    if(product >= mIntegrators.size())
+        return false;
+
+    const auto &image = mIntegrators[product].getImage();
+    if(level > 0)
+        mPyramids[product].build(image);
+
+    return mPyramids[product].getRegion(image, level, x0, y0, x1, y1, output);
+
+}
+
+std::string HistogramManager::getProductTopic(std::size_t product, int level) {
+
+    // fixed width so that subscribing to one topic doesn't also match e.g. product 10 when asking for product 1,
+    // and binned levels lead with the bin size so that "hist" doesn't match them
+    auto index = std::to_string(product);
+    auto topic = "hist" + std::string(3 - std::min<std::size_t>(index.size(), 3), '0') + index;
+    if(level > 0)
+        topic = "bin" + std::to_string(1 << level) + "_" + topic;
+
+    return topic;
+
+}
+
+void HistogramManager::collectPartials() {
+
+    mWorkers->drain();
+
+    for(auto &shard : mPartials) {
+        for(std::size_t p = 0; p < shard.size(); ++p) {
+            shard[p].addTo(mHistograms[p]);
+            if(mScanGateOpen && p == mScanProduct)
+                shard[p].addTo(mScanImage);
+            shard[p].clear();
+        }
+    }
+
+}
+
+bool HistogramManager::openScanGate(std::size_t product) {
+
+    if(product >= mProducts.size())
+        return false;
+
+    // hits from before the gate opened stay out of it
+    collectPartials();
+
+    mScanGateOpen = true;
+    mScanProduct = product;
+    mScanImage.assign(HistogramAccumulator<std::uint32_t>::NUM_PIXELS, 0);
+
+    return true;
+
+}
+
+std::uint64_t HistogramManager::getScanGateCount() {
+
+    collectPartials();
+
+    std::uint64_t count = 0;
+    for(auto x : mScanImage)
+        count += x;
+
+    return count;
+
+}
+
+const std::vector<std::uint64_t>& HistogramManager::closeScanGate() {
+
+    collectPartials();
+    mScanGateOpen = false;
+
+    return mScanImage;
+
+}
+
+void HistogramManager::publish() {
+
+    if(auto dropped = mWorkers->takeNumDropped())
+        mThread.sendWarn("Histogram workers fell behind; dropped " + std::to_string(dropped) + " packet batches");
+
+    collectPartials();
+
+    for(std::size_t p = 0; p < mHistograms.size(); ++p) {
+
+        auto &histogram = mHistograms[p];
+        const auto &image = mIntegrators[p].integrate(histogram);
+        std::fill(histogram.begin(), histogram.end(), 0); // reset histogram
+
+        if(mPublishPyramid)
+            mPyramids[p].build(image);
+
+        int num_levels = mPublishPyramid ? HistogramPyramid::NUM_LEVELS : 1;
+        for(int level = 0; level < num_levels; ++level) {
+
+            auto &encoder = mEncoders[p][level];
+            encoder.encode(level == 0 ? image : mPyramids[p].getLevel(level));
+
+            // the default single ungated image, sent dense without binned levels, goes out as one frame of counts as
+            // it always has; anything a client asked for goes out as [topic][header][image]
+            if(mDefaultProducts && !mAutomaticEncoding && !mPublishPyramid) {
+                mPublishSocket->send(zmq::buffer(encoder.getPayload()), zmq::send_flags::dontwait);
+                continue;
+            }
+
+            mPublishSocket->send(zmq::buffer(getProductTopic(p, level)), zmq::send_flags::sndmore | zmq::send_flags::dontwait);
+            mPublishSocket->send(zmq::buffer(encoder.getHeader()), zmq::send_flags::sndmore | zmq::send_flags::dontwait);
+            mPublishSocket->send(zmq::buffer(encoder.getPayload()), zmq::send_flags::dontwait);
+
+        }
+
+    }
+
+    publishTofSpectrum();
+
+}
+
+void HistogramManager::publishTofSpectrum() {
+
+    if(!mTofSettings.isEnabled())
+        return;
+
+    for(auto &tof : mTofPartials) {
+        tof.addTo(mTofSpectrum);
+        tof.clear();
+    }
+
+    // sent as [topic]["version, bin width, number of bins, sequence number"][one 32-bit count per bin]
+    mTofFrame.resize(TOF_HEADER_WORDS + mTofSpectrum.size());
+    mTofFrame[0] = TOF_FRAME_VERSION;
+    mTofFrame[1] = mTofSettings.bin_width;
+    mTofFrame[2] = mTofSettings.num_bins;
+    mTofFrame[3] = mTofSequence++;
+
+    constexpr std::uint64_t max_count = std::numeric_limits<std::uint32_t>::max();
+    for(std::size_t ix = 0; ix < mTofSpectrum.size(); ++ix)
+        mTofFrame[TOF_HEADER_WORDS + ix] = static_cast<std::uint32_t>(std::min(mTofSpectrum[ix], max_count));
+
+    mPublishSocket->send(zmq::buffer(std::string("tof")), zmq::send_flags::sndmore | zmq::send_flags::dontwait);
+    mPublishSocket->send(zmq::buffer(mTofFrame.data(), TOF_HEADER_WORDS*4), zmq::send_flags::sndmore | zmq::send_flags::dontwait);
+    mPublishSocket->send(zmq::buffer(mTofFrame.data() + TOF_HEADER_WORDS, mTofSpectrum.size()*4), zmq::send_flags::dontwait);
+
+    std::fill(mTofSpectrum.begin(), mTofSpectrum.end(), 0);
+
+}
+
+void HistogramManager::publishRoiCounts() {
+
+    // no drain: batches still being processed are counted in the next tick instead
+    for(auto &roi : mRoiPartials)
+        roi.collectInto(mRoiCounts);
+
+    auto now = std::chrono::high_resolution_clock::now();
+    auto elapsed_us = std::chrono::duration_cast<std::chrono::microseconds>(now - mLastRoiTime).count();
+    mLastRoiTime = now;
+
+    // sent as [topic]["version, number of regions, sequence number, tick length in us"][one 32-bit count per region]
+    mRoiFrame.resize(ROI_HEADER_WORDS + mRoiCounts.size());
+    mRoiFrame[0] = ROI_FRAME_VERSION;
+    mRoiFrame[1] = static_cast<std::uint32_t>(mRoiCounts.size());
+    mRoiFrame[2] = mRoiSequence++;
+    mRoiFrame[3] = static_cast<std::uint32_t>(elapsed_us);
+
+    constexpr std::uint64_t max_count = std::numeric_limits<std::uint32_t>::max();
+    for(std::size_t ix = 0; ix < mRoiCounts.size(); ++ix)
+        mRoiFrame[ROI_HEADER_WORDS + ix] = static_cast<std::uint32_t>(std::min(mRoiCounts[ix], max_count));
+
+    mPublishSocket->send(zmq::buffer(std::string("roi")), zmq::send_flags::sndmore | zmq::send_flags::dontwait);
+    mPublishSocket->send(zmq::buffer(mRoiFrame.data(), ROI_HEADER_WORDS*4), zmq::send_flags::sndmore | zmq::send_flags::dontwait);
+    mPublishSocket->send(zmq::buffer(mRoiFrame.data() + ROI_HEADER_WORDS, mRoiCounts.size()*4), zmq::send_flags::dontwait);
+
+    std::fill(mRoiCounts.begin(), mRoiCounts.end(), 0);
+
+}
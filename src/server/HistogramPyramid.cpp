@@ -0,0 +1,64 @@
+#include "server/HistogramPyramid.h"
+
+HistogramPyramid::HistogramPyramid() {
+
+    for(int level = 1; level < NUM_LEVELS; ++level)
+        mLevels[level].resize(getWidth(level) * getWidth(level), 0);
+
+}
+
+void HistogramPyramid::build(const std::vector<std::uint64_t> &image) {
+
+    // each level is binned from the one below, so every pixel of the full image is read once
+    const auto *src = image.data();
+    for(int level = 1; level < NUM_LEVELS; ++level) {
+
+        auto width = getWidth(level);
+        auto src_width = width * 2;
+        auto *dst = mLevels[level].data();
+
+        for(std::size_t y = 0; y < width; ++y) {
+            const auto *row0 = src + (2*y)*src_width;
+            const auto *row1 = row0 + src_width;
+            for(std::size_t x = 0; x < width; ++x)
+                dst[x + y*width] = row0[2*x] + row0[2*x + 1] + row1[2*x] + row1[2*x + 1];
+        }
+
+        src = dst;
+
+    }
+
+}
+
+const std::vector<std::uint64_t>& HistogramPyramid::getLevel(int level) const {
+
+    return mLevels[level];
+
+}
+
+std::size_t HistogramPyramid::getWidth(int level) {
+
+    return static_cast<std::size_t>(256) >> level;
+
+}
+
+bool HistogramPyramid::getRegion(const std::vector<std::uint64_t> &image, int level, std::size_t x0, std::size_t y0,
+                                 std::size_t x1, std::size_t y1, std::vector<std::uint64_t> &output) const {
+
+    if(level < 0 || level >= NUM_LEVELS)
+        return false;
+
+    auto width = getWidth(level);
+    if(x0 >= x1 || y0 >= y1 || x1 > width || y1 > width)
+        return false;
+
+    const auto &src = (level == 0) ? image : mLevels[level];
+
+    output.clear();
+    output.reserve((x1 - x0) * (y1 - y0));
+    for(std::size_t y = y0; y < y1; ++y)
+        output.insert(output.end(), src.begin() + (x0 + y*width), src.begin() + (x1 + y*width));
+
+    return true;
+
+}
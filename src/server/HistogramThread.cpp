@@ -1,6 +1,13 @@
 #include "server/HistogramThread.h"
 
+#include <algorithm>
+#include <limits>
+
 #include "server/HistogramManager.h"
+#include "server/HistogramProduct.h"
+#include "server/RoiCounter.h"
+#include "server/VolumeAccumulator.h"
+#include "server/TofAccumulator.h"
 
 HistogramThread::HistogramThread(CommsThread &parent) :
     SecondaryThread(parent),
@@ -48,6 +55,94 @@ void HistogramThread::handleCommand(ServerCommand cmd, const DataVec &data) {
         setHistogramOutputPeriod(data);
         break;
 
+    case ServerCommand::SET_HISTOGRAM_COUNTER_WIDTH:
+        setHistogramCounterWidth(data);
+        break;
+
+    case ServerCommand::SET_HISTOGRAM_THREADS:
+        setHistogramThreads(data);
+        break;
+
+    case ServerCommand::SET_HISTOGRAM_PRODUCTS:
+        setHistogramProducts(data);
+        break;
+
+    case ServerCommand::SET_HISTOGRAM_ENCODING:
+        setHistogramEncoding(data);
+        break;
+
+    case ServerCommand::SET_HISTOGRAM_MODE:
+        setHistogramMode(data);
+        break;
+
+    case ServerCommand::RESET_HISTOGRAM:
+        resetHistogram(data);
+        break;
+
+    case ServerCommand::GET_HISTOGRAM_IMAGE:
+        sendHistogramImage(data);
+        break;
+
+    case ServerCommand::SET_TOF_HISTOGRAM:
+        setTofHistogram(data);
+        break;
+
+    case ServerCommand::SET_HISTOGRAM_PYRAMID:
+        setHistogramPyramid(data);
+        break;
+
+    case ServerCommand::GET_HISTOGRAM_REGION:
+        sendHistogramRegion(data);
+        break;
+
+    case ServerCommand::SET_ROI_REGIONS:
+        setRoiRegions(data);
+        break;
+
+    case ServerCommand::SET_ROI_OUTPUT_PERIOD:
+        setRoiOutputPeriod(data);
+        break;
+
+    case ServerCommand::SET_HISTOGRAM_VOLUME:
+        setHistogramVolume(data);
+        break;
+
+    case ServerCommand::GET_VOLUME_SLICE:
+        sendVolumeSlice(data);
+        break;
+
+    case ServerCommand::GET_VOLUME_PROJECTION:
+        sendVolumeProjection(data);
+        break;
+
+    case ServerCommand::SET_TOT_CUBE:
+        setTotCube(data);
+        break;
+
+    case ServerCommand::GET_TOT_CUBE:
+        sendTotCube(data);
+        break;
+
+    case ServerCommand::SAVE_TOT_CUBE:
+        saveTotCube(data);
+        break;
+
+    case ServerCommand::SET_FRAME_STACK:
+        setFrameStack(data);
+        break;
+
+    case ServerCommand::SET_FRAME_STACK_FILE:
+        setFrameStackFile(data);
+        break;
+
+    case ServerCommand::SET_SCAN_GATE:
+        setScanGate(data);
+        break;
+
+    case ServerCommand::GET_SCAN_GATE_COUNT:
+        sendScanGateCount(data);
+        break;
+
     default:
         sendError(ServerCommand::UNKNOWN_COMMAND);
         break;
@@ -108,3 +203,342 @@ void HistogramThread::setHistogramOutputPeriod(const DataVec &data) {
     sendResponse(data);
 
 }
+
+void HistogramThread::setHistogramCounterWidth(const DataVec &data) {
+
+    if(data.size() != 1 || !mHistogramManager->setCounterWidth(data[0])) {
+        sendError(ServerCommand::INVALID_COMMAND_DATA);
+        return;
+    }
+
+    sendResponse(data);
+
+}
+
+void HistogramThread::setHistogramThreads(const DataVec &data) {
+
+    constexpr std::uint32_t MAX_THREADS = 64;
+
+    if(data.size() != 1 || data[0] > MAX_THREADS) {
+        sendError(ServerCommand::INVALID_COMMAND_DATA);
+        return;
+    }
+
+    mHistogramManager->setNumThreads(data[0]);
+
+    sendResponse(data);
+
+}
+
+void HistogramThread::setHistogramProducts(const DataVec &data) {
+
+    constexpr std::size_t MAX_PRODUCTS = 16;
+
+    if(data.size() % HistogramProduct::NUM_CONFIG_WORDS != 0 || data.size() / HistogramProduct::NUM_CONFIG_WORDS > MAX_PRODUCTS) {
+        sendError(ServerCommand::INVALID_COMMAND_DATA);
+        return;
+    }
+
+    std::vector<HistogramProduct> products(data.size() / HistogramProduct::NUM_CONFIG_WORDS);
+    for(std::size_t ix = 0; ix < products.size(); ++ix) {
+        if(!products[ix].fromConfigWords(data.data() + ix*HistogramProduct::NUM_CONFIG_WORDS)) {
+            sendError(ServerCommand::INVALID_COMMAND_DATA);
+            return;
+        }
+    }
+
+    mHistogramManager->setProducts(products);
+
+    sendResponse(data);
+
+}
+
+void HistogramThread::setHistogramEncoding(const DataVec &data) {
+
+    if(data.size() != 1 || data[0] > 1) {
+        sendError(ServerCommand::INVALID_COMMAND_DATA);
+        return;
+    }
+
+    mHistogramManager->setAutomaticEncoding(data[0] == 1);
+
+    sendResponse(data);
+
+}
+
+void HistogramThread::setHistogramMode(const DataVec &data) {
+
+    if(data.size() != 2 || !mHistogramManager->setMode(static_cast<HistogramMode>(data[0]), data[1])) {
+        sendError(ServerCommand::INVALID_COMMAND_DATA);
+        return;
+    }
+
+    sendResponse(data);
+
+}
+
+void HistogramThread::resetHistogram(const DataVec &data) {
+
+    if(data.size() != 0) {
+        sendError(ServerCommand::INVALID_COMMAND_DATA);
+        return;
+    }
+
+    mHistogramManager->reset();
+
+    sendResponse(data);
+
+}
+
+void HistogramThread::sendHistogramImage(const DataVec &data) {
+
+    if(data.size() != 1) {
+        sendError(ServerCommand::INVALID_COMMAND_DATA);
+        return;
+    }
+
+    auto image = mHistogramManager->getImage(data[0]);
+    if(!image) {
+        sendError(ServerCommand::INVALID_COMMAND_DATA);
+        return;
+    }
+
+    sendCounts(*image);
+
+}
+
+void HistogramThread::setTofHistogram(const DataVec &data) {
+
+    TofSettings settings;
+    if(!settings.fromConfigWords(data.data(), data.size())) {
+        sendError(ServerCommand::INVALID_COMMAND_DATA);
+        return;
+    }
+
+    mHistogramManager->setTofSettings(settings);
+
+    sendResponse(data);
+
+}
+
+void HistogramThread::setHistogramPyramid(const DataVec &data) {
+
+    if(data.size() != 1 || data[0] > 1) {
+        sendError(ServerCommand::INVALID_COMMAND_DATA);
+        return;
+    }
+
+    mHistogramManager->setPyramidOutput(data[0] == 1);
+
+    sendResponse(data);
+
+}
+
+void HistogramThread::sendHistogramRegion(const DataVec &data) {
+
+    // [product, level, x0, y0, x1, y1]
+    std::vector<std::uint64_t> region;
+    if(data.size() != 6 || !mHistogramManager->getRegion(data[0], data[1], data[2], data[3], data[4], data[5], region)) {
+        sendError(ServerCommand::INVALID_COMMAND_DATA);
+        return;
+    }
+
+    sendCounts(region);
+
+}
+
+void HistogramThread::setRoiRegions(const DataVec &data) {
+
+    auto table = std::make_shared<RoiTable>();
+    if(!table->fromConfigWords(data.data(), data.size())) {
+        sendError(ServerCommand::INVALID_COMMAND_DATA);
+        return;
+    }
+
+    mHistogramManager->setRoiTable(table);
+
+    sendResponse({static_cast<std::uint32_t>(table->num_rois)});
+
+}
+
+void HistogramThread::setRoiOutputPeriod(const DataVec &data) {
+
+    if(data.size() != 1 || data[0] == 0) {
+        sendError(ServerCommand::INVALID_COMMAND_DATA);
+        return;
+    }
+
+    mHistogramManager->setRoiPeriod(data[0]);
+
+    sendResponse(data);
+
+}
+
+void HistogramThread::setHistogramVolume(const DataVec &data) {
+
+    VolumeSettings settings;
+    if(!settings.fromConfigWords(data.data(), data.size())) {
+        sendError(ServerCommand::INVALID_COMMAND_DATA);
+        return;
+    }
+
+    mHistogramManager->setVolumeSettings(settings);
+
+    sendResponse(data);
+
+}
+
+void HistogramThread::sendVolumeSlice(const DataVec &data) {
+
+    // [first ToF bin, last ToF bin + 1]
+    std::vector<std::uint64_t> slice;
+    if(data.size() != 2 || !mHistogramManager->getVolumeSlice(data[0], data[1], slice)) {
+        sendError(ServerCommand::INVALID_COMMAND_DATA);
+        return;
+    }
+
+    sendCounts(slice);
+
+}
+
+void HistogramThread::sendVolumeProjection(const DataVec &data) {
+
+    std::vector<std::uint64_t> projection;
+    if(data.size() != 1 || !mHistogramManager->getVolumeProjection(static_cast<VolumeAccumulator::ProjectionAxis>(data[0]), projection)) {
+        sendError(ServerCommand::INVALID_COMMAND_DATA);
+        return;
+    }
+
+    sendCounts(projection);
+
+}
+
+void HistogramThread::sendCounts(const std::vector<std::uint64_t> &counts) {
+
+    DataVec response(counts.size());
+    constexpr std::uint64_t max_count = std::numeric_limits<std::uint32_t>::max();
+    for(std::size_t ix = 0; ix < counts.size(); ++ix)
+        response[ix] = static_cast<std::uint32_t>(std::min(counts[ix], max_count));
+
+    sendResponse(response);
+
+}
+
+void HistogramThread::setTotCube(const DataVec &data) {
+
+    // [number of bins, bin width]
+    if(data.size() != 2 || !mHistogramManager->setTotCubeBins(data[0], data[1])) {
+        sendError(ServerCommand::INVALID_COMMAND_DATA);
+        return;
+    }
+
+    sendResponse(data);
+
+}
+
+void HistogramThread::sendTotCube(const DataVec &data) {
+
+    // [first pixel, number of pixels]; the whole cube can be too big for one reply, so clients fetch it in pieces of
+    // at most TotCube::MAX_READ_WORDS counters
+    DataVec spectra;
+    if(data.size() != 2 || !mHistogramManager->getTotCubePixels(data[0], data[1], spectra)) {
+        sendError(ServerCommand::INVALID_COMMAND_DATA);
+        return;
+    }
+
+    sendResponse(spectra);
+
+}
+
+void HistogramThread::saveTotCube(const DataVec &data) {
+
+    std::vector<char> path;
+    for(auto x : data) {
+        path.push_back(static_cast<char>(x));
+    }
+    path.push_back('\0');
+
+    std::string s(path.data());
+
+    DEBUG("Saving per-pixel ToT spectra to: " + s);
+
+    if(mHistogramManager->saveTotCube(s)) {
+        sendResponse(data);
+    } else {
+        sendError(ServerCommand::ERROR_OCCURED);
+    }
+
+}
+
+void HistogramThread::setFrameStack(const DataVec &data) {
+
+    // [frame length lo, frame length hi, tolerance lo, tolerance hi], in ToA units
+    if(data.size() != 4) {
+        sendError(ServerCommand::INVALID_COMMAND_DATA);
+        return;
+    }
+
+    auto frame_length = data[0] | (static_cast<std::uint64_t>(data[1]) << 32);
+    auto tolerance = data[2] | (static_cast<std::uint64_t>(data[3]) << 32);
+    mHistogramManager->setFrameStack(frame_length, tolerance);
+
+    sendResponse(data);
+
+}
+
+void HistogramThread::setFrameStackFile(const DataVec &data) {
+
+    // [capacity in frames, path...]
+    if(data.size() < 1) {
+        sendError(ServerCommand::INVALID_COMMAND_DATA);
+        return;
+    }
+
+    std::vector<char> path;
+    for(std::size_t ix = 1; ix < data.size(); ++ix) {
+        path.push_back(static_cast<char>(data[ix]));
+    }
+    path.push_back('\0');
+
+    std::string s(path.data());
+
+    DEBUG("Writing frames to: " + s);
+
+    if(mHistogramManager->setFrameFile(s, data[0])) {
+        sendResponse(data);
+    } else {
+        sendError(ServerCommand::ERROR_OCCURED);
+    }
+
+}
+
+void HistogramThread::setScanGate(const DataVec &data) {
+
+    // [1, product] opens the gate; [0] closes it and returns the image of the hits counted while it was open
+    if(data.empty() || data[0] > 1 || data.size() != (data[0] ? 2 : 1)) {
+        sendError(ServerCommand::INVALID_COMMAND_DATA);
+        return;
+    }
+
+    if(data[0]) {
+        if(mHistogramManager->openScanGate(data[1]))
+            sendResponse(data);
+        else
+            sendError(ServerCommand::INVALID_COMMAND_DATA);
+    } else {
+        sendCounts(mHistogramManager->closeScanGate());
+    }
+
+}
+
+void HistogramThread::sendScanGateCount(const DataVec &data) {
+
+    if(data.size() != 0) {
+        sendError(ServerCommand::INVALID_COMMAND_DATA);
+        return;
+    }
+
+    auto count = mHistogramManager->getScanGateCount();
+    sendResponse({static_cast<std::uint32_t>(count), static_cast<std::uint32_t>(count >> 32)});
+
+}
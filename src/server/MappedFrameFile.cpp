@@ -0,0 +1,116 @@
+#include "server/MappedFrameFile.h"
+
+#include <atomic>
+#include <cstring>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+MappedFrameFile::~MappedFrameFile() {
+
+    close();
+
+}
+
+bool MappedFrameFile::open(const std::string &path, std::uint64_t frame_length, std::uint64_t capacity) {
+
+    close();
+
+    if(capacity == 0)
+        return false;
+
+    auto size = HEADER_BYTES + capacity * FRAME_BYTES;
+
+#ifdef _WIN32
+    mFile = CreateFileA(path.c_str(), GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ, nullptr, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if(mFile == INVALID_HANDLE_VALUE)
+        return false;
+    mMapping = CreateFileMappingA(mFile, nullptr, PAGE_READWRITE, static_cast<DWORD>(size >> 32), static_cast<DWORD>(size), nullptr);
+    if(!mMapping) {
+        close();
+        return false;
+    }
+    mData = static_cast<std::uint8_t*>(MapViewOfFile(mMapping, FILE_MAP_WRITE, 0, 0, 0));
+#else
+    mFile = ::open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if(mFile < 0)
+        return false;
+    if(ftruncate(mFile, static_cast<off_t>(size)) != 0) {
+        close();
+        return false;
+    }
+    auto ptr = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, mFile, 0);
+    mData = (ptr == MAP_FAILED) ? nullptr : static_cast<std::uint8_t*>(ptr);
+#endif
+
+    if(!mData) {
+        close();
+        return false;
+    }
+
+    mSize = size;
+    mCapacity = capacity;
+    mNumFrames = 0;
+
+    std::memcpy(mData, "TPXFRAME", 8);
+    std::memcpy(mData + 8, &frame_length, 8);
+    std::memcpy(mData + 16, &capacity, 8);
+    std::memcpy(mData + 24, &mNumFrames, 8);
+
+    return true;
+
+}
+
+void MappedFrameFile::close() {
+
+#ifdef _WIN32
+    if(mData)
+        UnmapViewOfFile(mData);
+    if(mMapping)
+        CloseHandle(mMapping);
+    if(mFile != INVALID_HANDLE_VALUE)
+        CloseHandle(mFile);
+    mMapping = nullptr;
+    mFile = INVALID_HANDLE_VALUE;
+#else
+    if(mData)
+        munmap(mData, mSize);
+    if(mFile >= 0)
+        ::close(mFile);
+    mFile = -1;
+#endif
+
+    mData = nullptr;
+    mSize = 0;
+
+}
+
+bool MappedFrameFile::isOpen() const {
+
+    return mData != nullptr;
+
+}
+
+bool MappedFrameFile::isFull() const {
+
+    return mNumFrames >= mCapacity;
+
+}
+
+void MappedFrameFile::write(std::uint64_t frame_index, const std::vector<std::uint32_t> &counts) {
+
+    if(!isOpen() || isFull())
+        return;
+
+    auto *frame = mData + HEADER_BYTES + mNumFrames * FRAME_BYTES;
+    std::memcpy(frame, &frame_index, 8);
+    std::memcpy(frame + 8, counts.data(), counts.size() * sizeof(std::uint32_t));
+
+    // the count is stored last, with release ordering, so that a reader never sees a frame before its data
+    ++mNumFrames;
+    std::atomic_ref<std::uint64_t>(*reinterpret_cast<std::uint64_t*>(mData + 24)).store(mNumFrames, std::memory_order_release);
+
+}
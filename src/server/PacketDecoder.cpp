@@ -0,0 +1,75 @@
+#include "server/PacketDecoder.h"
+
+constexpr std::uint64_t FULL_TOA_MASK = 0x3FFFFFFFF;
+constexpr auto QUARTER_TIME = (static_cast<std::uint64_t>(1)<<32);
+constexpr auto THREE_QUARTER_TIME = 3*QUARTER_TIME;
+
+void PacketDecoder::decode(const std::uint64_t *raw, std::size_t num_words, std::vector<std::uint64_t> &output) {
+
+    auto start = output.size();
+    output.resize(start + num_words);
+
+    auto num_hits = decodeHits(raw, num_words, output.data() + start);
+    extendToA(output.data() + start, num_hits);
+
+    output.resize(start + num_hits);
+
+}
+
+std::size_t PacketDecoder::decodeHits(const std::uint64_t *raw, std::size_t num_words, std::uint64_t *output) {
+
+    std::size_t num_hits = 0;
+
+    for(std::size_t ix = 0; ix < num_words; ++ix) {
+
+        auto type = (raw[ix] & 0xF000000000000000);
+        if(type != 0xB000000000000000)
+            continue;
+
+        auto addr = (raw[ix] & 0x0FFFF00000000000) >> 44;
+        std::uint64_t x = ((addr >> 1) & 0x00FC) | (addr & 0x0003);
+        std::uint64_t y = ((addr >> 8) & 0x00FE) | ((addr >> 2) & 0x0001);
+
+        auto tot = (raw[ix] & 0x000000003FF00000) >> 20;
+
+        auto toa = (raw[ix] & 0x00000FFFC0000000) >> 30;
+        auto ftoa = ((raw[ix] & 0x00000000000F0000) >> 16) ^ 0x0F;
+        auto stime = (raw[ix] & 0x000000000000FFFF);
+
+        auto full_toa = (stime << 18) | (toa << 4) | ftoa;
+
+        output[num_hits++] = (x << 56) | (y << 48) | (tot << 38) | full_toa;
+
+    }
+
+    return num_hits;
+
+}
+
+void PacketDecoder::extendToA(std::uint64_t *hits, std::size_t num_hits) {
+
+    for(std::size_t ix = 0; ix < num_hits; ++ix) {
+
+        auto full_toa = hits[ix] & FULL_TOA_MASK;
+
+        if(full_toa > QUARTER_TIME && full_toa < THREE_QUARTER_TIME)
+            mHalfwayToRollover = true;
+
+        if(mHalfwayToRollover && (mLastToA > THREE_QUARTER_TIME) && (full_toa < QUARTER_TIME)) {
+            mHalfwayToRollover = false;
+            mRolloverCounter = (mRolloverCounter + 1) & 0x0F;
+        }
+
+        hits[ix] |= static_cast<std::uint64_t>(mRolloverCounter) << 34;
+
+        mLastToA = full_toa;
+
+    }
+
+}
+
+void PacketDecoder::resetRolloverCounter() {
+
+    mRolloverCounter = 0;
+
+}
@@ -0,0 +1,97 @@
+#include "server/PacketWorkerPool.h"
+
+#include <utility>
+
+PacketWorkerPool::PacketWorkerPool(std::size_t num_workers, Handler handler) :
+    mHandler(std::move(handler)) {
+
+    mWorkers.reserve(num_workers);
+    for(std::size_t ix = 0; ix < num_workers; ++ix)
+        mWorkers.emplace_back(&PacketWorkerPool::run, this, ix);
+
+}
+
+PacketWorkerPool::~PacketWorkerPool() {
+
+    {
+        std::lock_guard lock(mMutex);
+        mStopping = true;
+    }
+    mWorkAvailable.notify_all();
+
+    for(auto &worker : mWorkers)
+        worker.join();
+
+}
+
+std::size_t PacketWorkerPool::getNumShards() const {
+
+    return std::max<std::size_t>(mWorkers.size(), 1);
+
+}
+
+bool PacketWorkerPool::submit(std::vector<std::uint64_t> &&batch) {
+
+    if(mWorkers.empty()) {
+        mHandler(0, batch.data(), batch.size());
+        return true;
+    }
+
+    {
+        std::lock_guard lock(mMutex);
+        if(mQueue.size() >= MAX_QUEUED_BATCHES) {
+            ++mNumDropped;
+            return false;
+        }
+        mQueue.push_back(std::move(batch));
+    }
+    mWorkAvailable.notify_one();
+
+    return true;
+
+}
+
+std::uint64_t PacketWorkerPool::takeNumDropped() {
+
+    std::lock_guard lock(mMutex);
+    return std::exchange(mNumDropped, 0);
+
+}
+
+void PacketWorkerPool::drain() {
+
+    std::unique_lock lock(mMutex);
+    mWorkDone.wait(lock, [this]() {
+        return mQueue.empty() && mBusyWorkers == 0;
+    });
+
+}
+
+void PacketWorkerPool::run(std::size_t shard) {
+
+    std::unique_lock lock(mMutex);
+
+    while(true) {
+
+        mWorkAvailable.wait(lock, [this]() {
+            return mStopping || !mQueue.empty();
+        });
+
+        if(mQueue.empty()) // only reached when stopping
+            return;
+
+        auto batch = std::move(mQueue.front());
+        mQueue.pop_front();
+        ++mBusyWorkers;
+
+        lock.unlock();
+        mHandler(shard, batch.data(), batch.size());
+        lock.lock();
+
+        --mBusyWorkers;
+        if(mQueue.empty() && mBusyWorkers == 0)
+            mWorkDone.notify_all();
+
+    }
+
+}
@@ -2,6 +2,8 @@
 
 #include "server/CommsThread.h"
 
+#include "server/Equalizer.h"
+#include "server/ScanEngine.h"
 #include "server/ServerCodes.h"
 
 #include "server/TimepixCodes.h"
@@ -17,12 +19,12 @@ const std::map<ServerCommand, void (PythonConnectionManager::*)(const DataVec &)
     {ServerCommand::GET_FIRMWARE_VERSION, &PythonConnectionManager::genericForward<0, TpxCommand::CMD_GET_FIRMWVERSION>},
     {ServerCommand::GET_CAMERA_ID, &PythonConnectionManager::genericForward<0, TpxCommand::CMD_GET_CHIPBOARDID>},
     {ServerCommand::GET_DEVICE_IDS, &PythonConnectionManager::genericForward<0, TpxCommand::CMD_GET_DEVICEIDS>},
-    {ServerCommand::GET_LOCAL_TEMP, &PythonConnectionManager::genericForward<0, TpxCommand::CMD_GET_LOCALTEMP>},
+    {ServerCommand::GET_LOCAL_TEMP, &PythonConnectionManager::telemetryForward<TpxCommand::CMD_GET_LOCALTEMP>},
     {ServerCommand::GET_REMOTE_TEMP, &PythonConnectionManager::genericForward<0, TpxCommand::CMD_GET_REMOTETEMP>},
-    {ServerCommand::GET_FPGA_TEMP, &PythonConnectionManager::genericForward<0, TpxCommand::CMD_GET_FPGATEMP>},
-    {ServerCommand::GET_FAN_SPEED, &PythonConnectionManager::genericForward<0, TpxCommand::CMD_GET_FANSPEED>},
-    {ServerCommand::GET_PRESSURE, &PythonConnectionManager::genericForward<0, TpxCommand::CMD_GET_PRESSURE>},
-    {ServerCommand::GET_HUMIDITY, &PythonConnectionManager::genericForward<0, TpxCommand::CMD_GET_HUMIDITY>},
+    {ServerCommand::GET_FPGA_TEMP, &PythonConnectionManager::telemetryForward<TpxCommand::CMD_GET_FPGATEMP>},
+    {ServerCommand::GET_FAN_SPEED, &PythonConnectionManager::telemetryForward<TpxCommand::CMD_GET_FANSPEED>},
+    {ServerCommand::GET_PRESSURE, &PythonConnectionManager::telemetryForward<TpxCommand::CMD_GET_PRESSURE>},
+    {ServerCommand::GET_HUMIDITY, &PythonConnectionManager::telemetryForward<TpxCommand::CMD_GET_HUMIDITY>},
     {ServerCommand::GET_SPIDR_ADC, &PythonConnectionManager::genericForward<1, TpxCommand::CMD_GET_SPIDR_ADC>},
     {ServerCommand::SET_BIAS_VOLTAGE, &PythonConnectionManager::genericForward<1, TpxCommand::CMD_SET_BIAS_ADJUST>},
     {ServerCommand::SET_BIAS_SUPPLY_ENABLED, &PythonConnectionManager::genericForward<1, TpxCommand::CMD_BIAS_SUPPLY_ENA>},
@@ -33,19 +35,19 @@ const std::map<ServerCommand, void (PythonConnectionManager::*)(const DataVec &)
     {ServerCommand::RESTART_TIMERS, &PythonConnectionManager::genericForward<0, TpxCommand::CMD_RESTART_TIMERS>},
     {ServerCommand::RESET_TIMERS, &PythonConnectionManager::genericForward<0, TpxCommand::CMD_RESET_TIMER>},
     {ServerCommand::RESET_PIXELS, &PythonConnectionManager::genericForward<0, TpxCommand::CMD_RESET_PIXELS>},
-    {ServerCommand::GET_SPIDR_REGISTER, &PythonConnectionManager::genericForward<1, TpxCommand::CMD_GET_SPIDRREG>},
+    {ServerCommand::GET_SPIDR_REGISTER, &PythonConnectionManager::cachedForward<1, TpxCommand::CMD_GET_SPIDRREG>},
     {ServerCommand::SET_SPIDR_REGISTER, &PythonConnectionManager::genericForward<2, TpxCommand::CMD_SET_SPIDRREG>},
-    {ServerCommand::GET_PLL_CONFIG, &PythonConnectionManager::genericForward<0, TpxCommand::CMD_GET_PLLCONFIG>},
+    {ServerCommand::GET_PLL_CONFIG, &PythonConnectionManager::cachedForward<0, TpxCommand::CMD_GET_PLLCONFIG>},
     {ServerCommand::SET_PLL_CONFIG, &PythonConnectionManager::genericForward<1, TpxCommand::CMD_SET_PLLCONFIG>},
-    {ServerCommand::GET_HEADER_FILTER, &PythonConnectionManager::genericForward<0, TpxCommand::CMD_GET_HEADERFILTER>},
+    {ServerCommand::GET_HEADER_FILTER, &PythonConnectionManager::cachedForward<0, TpxCommand::CMD_GET_HEADERFILTER>},
     {ServerCommand::SET_HEADER_FILTER, &PythonConnectionManager::genericForward<1, TpxCommand::CMD_SET_HEADERFILTER>},
-    {ServerCommand::GET_GEN_CONFIG, &PythonConnectionManager::genericForward<0, TpxCommand::CMD_GET_GENCONFIG>},
+    {ServerCommand::GET_GEN_CONFIG, &PythonConnectionManager::cachedForward<0, TpxCommand::CMD_GET_GENCONFIG>},
     {ServerCommand::SET_GEN_CONFIG, &PythonConnectionManager::genericForward<1, TpxCommand::CMD_SET_GENCONFIG>},
     {ServerCommand::GET_PERIOD_PHASE, &PythonConnectionManager::genericForward<0, TpxCommand::CMD_GET_TPPERIODPHASE>},
     {ServerCommand::SET_PERIOD_PHASE, &PythonConnectionManager::genericForward<1, TpxCommand::CMD_SET_TPPERIODPHASE>},
-    {ServerCommand::GET_TRIGGER_CONF, &PythonConnectionManager::genericForward<0, TpxCommand::CMD_GET_TRIGCONFIG>},
+    {ServerCommand::GET_TRIGGER_CONF, &PythonConnectionManager::cachedForward<0, TpxCommand::CMD_GET_TRIGCONFIG>},
     {ServerCommand::SET_TRIGGER_CONF, &PythonConnectionManager::genericForward<5, TpxCommand::CMD_SET_TRIGCONFIG>},
-    {ServerCommand::GET_DAC, &PythonConnectionManager::genericForward<1, TpxCommand::CMD_GET_DAC>},
+    {ServerCommand::GET_DAC, &PythonConnectionManager::cachedForward<1, TpxCommand::CMD_GET_DAC>},
     {ServerCommand::SET_DAC, &PythonConnectionManager::genericForward<1, TpxCommand::CMD_SET_DAC>},
     {ServerCommand::START_READOUT, &PythonConnectionManager::genericForward<0, TpxCommand::CMD_DDRIVEN_READOUT>},
     {ServerCommand::STOP_READOUT, &PythonConnectionManager::genericForward<0, TpxCommand::CMD_PAUSE_READOUT>},
@@ -53,6 +55,12 @@ const std::map<ServerCommand, void (PythonConnectionManager::*)(const DataVec &)
     {ServerCommand::AUTOTRIG_STOP, &PythonConnectionManager::genericForward<0, TpxCommand::CMD_AUTOTRIG_STOP>},
     {ServerCommand::GET_PIXEL_CONFIG, &PythonConnectionManager::genericForward<1, TpxCommand::CMD_GET_PIXCONF>},
     {ServerCommand::SET_PIXEL_CONFIG, &PythonConnectionManager::sendPixelConfigData},
+    {ServerCommand::UPLOAD_PIXEL_CONFIG, &PythonConnectionManager::uploadPixelConfig},
+    {ServerCommand::INVALIDATE_PIXEL_CONFIG, &PythonConnectionManager::invalidatePixelConfig},
+    {ServerCommand::SET_TELEMETRY_PERIOD, &PythonConnectionManager::setTelemetryPeriod},
+    {ServerCommand::BATCH, &PythonConnectionManager::executeBatch},
+    {ServerCommand::RUN_SCAN, &PythonConnectionManager::runScan},
+    {ServerCommand::EQUALIZE, &PythonConnectionManager::equalize},
     {ServerCommand::RESET_MODULE, &PythonConnectionManager::genericForward<1, TpxCommand::CMD_RESET_MODULE>},
     {ServerCommand::GET_READOUT_SPEED, &PythonConnectionManager::genericForward<0, TpxCommand::CMD_GET_READOUTSPEED>},
     {ServerCommand::SET_SENSEDAC, &PythonConnectionManager::genericForward<1, TpxCommand::CMD_SET_SENSEDAC>},
@@ -60,6 +68,14 @@ const std::map<ServerCommand, void (PythonConnectionManager::*)(const DataVec &)
     {ServerCommand::SET_UDP_PORT, &PythonConnectionManager::bindUdpPort}
 };
 
+// commands in COMMAND_MAP that are handled on this thread rather than queued for the Timepix
+std::set<ServerCommand> LOCAL_COMMANDS {
+    ServerCommand::INVALIDATE_PIXEL_CONFIG,
+    ServerCommand::SET_TELEMETRY_PERIOD,
+    ServerCommand::BATCH,
+    ServerCommand::SET_UDP_PORT
+};
+
 std::set<ServerCommand> UDP_THREAD_FORWARD_COMMANDS {
     ServerCommand::SET_RAW_TPX3_PATH,
     ServerCommand::GET_RAW_DATA_SERVER_PATH,
@@ -71,14 +87,39 @@ std::set<ServerCommand> CLUSTER_THREAD_FORWARD_COMMANDS {
     ServerCommand::SET_CLUSTER_INPUT_SERVER,
     ServerCommand::SET_CLUSTER_PARAMETERS,
     ServerCommand::FLUSH_CLUSTERS,
-    ServerCommand::SET_CLUSTER_PATH
+    ServerCommand::SET_CLUSTER_PATH,
+    ServerCommand::SET_CLUSTER_FLUSH_WATERMARK,
+    ServerCommand::SET_CLUSTER_FILTERS,
+    ServerCommand::GET_CLUSTER_FILTER_STATS,
+    ServerCommand::SET_CLUSTER_OUTPUT_FORMAT
 };
 
 std::set<ServerCommand> HISTOGRAM_THREAD_FORWARD_COMMANDS {
     ServerCommand::GET_HISTOGRAM_SERVER_PATH,
     ServerCommand::SET_HISTOGRAM_INPUT_SERVER,
-    ServerCommand::SET_HISTOGRAM_OUTPUT_PERIOD
-
+    ServerCommand::SET_HISTOGRAM_OUTPUT_PERIOD,
+    ServerCommand::SET_HISTOGRAM_COUNTER_WIDTH,
+    ServerCommand::SET_HISTOGRAM_THREADS,
+    ServerCommand::SET_HISTOGRAM_PRODUCTS,
+    ServerCommand::SET_HISTOGRAM_ENCODING,
+    ServerCommand::SET_HISTOGRAM_MODE,
+    ServerCommand::RESET_HISTOGRAM,
+    ServerCommand::GET_HISTOGRAM_IMAGE,
+    ServerCommand::SET_TOF_HISTOGRAM,
+    ServerCommand::SET_HISTOGRAM_PYRAMID,
+    ServerCommand::GET_HISTOGRAM_REGION,
+    ServerCommand::SET_ROI_REGIONS,
+    ServerCommand::SET_ROI_OUTPUT_PERIOD,
+    ServerCommand::SET_HISTOGRAM_VOLUME,
+    ServerCommand::GET_VOLUME_SLICE,
+    ServerCommand::GET_VOLUME_PROJECTION,
+    ServerCommand::SET_TOT_CUBE,
+    ServerCommand::GET_TOT_CUBE,
+    ServerCommand::SAVE_TOT_CUBE,
+    ServerCommand::SET_FRAME_STACK,
+    ServerCommand::SET_FRAME_STACK_FILE,
+    ServerCommand::SET_SCAN_GATE,
+    ServerCommand::GET_SCAN_GATE_COUNT
 };
 
 PythonConnectionManager::PythonConnectionManager(CommsThread &thread, TimepixConnectionManager &tpx) :
@@ -97,7 +138,8 @@ PythonConnectionManager::~PythonConnectionManager() {
 
 void PythonConnectionManager::open(unsigned int port) {
 
-    mCommandSocket = std::make_unique<zmq::socket_t>(mThread.getZmq(), zmq::socket_type::rep);
+    // a ROUTER socket, so that several clients can have requests outstanding at once
+    mCommandSocket = std::make_unique<zmq::socket_t>(mThread.getZmq(), zmq::socket_type::router);
     mCommandSocket->bind("tcp://*:" + std::to_string(port));
     DEBUG("Opened client socket on port " + port);
 
@@ -113,12 +155,35 @@ void PythonConnectionManager::close() {
 
 void PythonConnectionManager::poll() {
 
+    pollForwardedRequests();
+
     try {
-        zmq::message_t request;
-        auto incoming_msg = mCommandSocket->recv(request, zmq::recv_flags::dontwait);
+        // each request arrives as [identity][empty delimiter, from REQ clients][command]
+        zmq::message_t identity;
+        while(mCommandSocket->recv(identity, zmq::recv_flags::dontwait)) {
+
+            ClientId client {std::string(static_cast<const char*>(identity.data()), identity.size()), false};
+
+            zmq::message_t request;
+            mCommandSocket->recv(request);
+            if(request.size() == 0 && request.more()) {
+                client.delimited = true;
+                mCommandSocket->recv(request);
+            }
+
+            bool more = request.more();
+            while(more) { // extra frames aren't part of the protocol, so they are dropped
+                zmq::message_t extra;
+                mCommandSocket->recv(extra);
+                more = extra.more();
+            }
+
+            selectClient(client, ServerCommand::ERROR_OCCURED);
+            if(request.size() < 4)
+                sendError(ServerCommand::INVALID_COMMAND_DATA);
+            else
+                handleCommand(request);
 
-        if (incoming_msg) {
-            handleCommand(request);
         }
 
     } catch (zmq::error_t &ex) {
@@ -158,7 +223,7 @@ void PythonConnectionManager::handleCommand(zmq::message_t &command) {
             data.push_back(*(command_int_ptr + 1 + ix));
 
         auto f = COMMAND_MAP.at(command_code);
-        mLastCommand = command_code;
+        selectClient(mCurrentClient, command_code);
         ((*this).*f)(data);
     } else if(UDP_THREAD_FORWARD_COMMANDS.contains(command_code)) {
         forwardToSecondaryThread(mThread.getUdpThreadSocket(), command);
@@ -172,6 +237,39 @@ void PythonConnectionManager::handleCommand(zmq::message_t &command) {
     }
 }
 
+void PythonConnectionManager::selectClient(const ClientId &client, ServerCommand reply_code) {
+
+    mCurrentClient = client;
+    mLastCommand = reply_code;
+
+}
+
+const ClientId& PythonConnectionManager::getCurrentClient() const {
+
+    return mCurrentClient;
+
+}
+
+ServerCommand PythonConnectionManager::getCurrentCommand() const {
+
+    return mLastCommand;
+
+}
+
+void PythonConnectionManager::sendToClient(zmq::message_t &payload) {
+
+    if(mCurrentClient.batch) {
+        collectBatchReply(payload);
+        return;
+    }
+
+    mCommandSocket->send(zmq::buffer(mCurrentClient.identity), zmq::send_flags::sndmore | zmq::send_flags::dontwait);
+    if(mCurrentClient.delimited)
+        mCommandSocket->send(zmq::message_t(), zmq::send_flags::sndmore | zmq::send_flags::dontwait);
+    mCommandSocket->send(payload, zmq::send_flags::dontwait);
+
+}
+
 void PythonConnectionManager::sendError(ServerCommand errcode) {
 
     DEBUG("Sending error code to client: " + std::to_string(static_cast<std::uint32_t>(errcode)));
@@ -191,7 +289,8 @@ void PythonConnectionManager::sendResponse(const DataVec &data) {
     for(auto x : data)
         send_data.push_back(x);
 
-    mCommandSocket->send(zmq::buffer(send_data), zmq::send_flags::dontwait);
+    zmq::message_t msg(send_data.data(), send_data.size() * sizeof(std::uint32_t));
+    sendToClient(msg);
 
 }
 
@@ -204,6 +303,191 @@ void PythonConnectionManager::sendPixelConfigData(const DataVec &data) {
 
 }
 
+void PythonConnectionManager::uploadPixelConfig(const DataVec &data) {
+
+    // the whole matrix, one column after another, each packed as for SET_PIXEL_CONFIG
+    if(data.size() != TimepixConnectionManager::PIXEL_CONFIG_COLUMNS * TimepixConnectionManager::PIXEL_CONFIG_COLUMN_WORDS)
+        sendError(ServerCommand::INVALID_COMMAND_DATA);
+    else
+        mTpxManager->queueJob(this, CommandJob::PIXEL_UPLOAD, data);
+
+}
+
+void PythonConnectionManager::invalidatePixelConfig(const DataVec &data) {
+
+    if(!data.empty()) {
+        sendError(ServerCommand::INVALID_COMMAND_DATA);
+        return;
+    }
+
+    mTpxManager->invalidatePixelConfig();
+    sendResponse({});
+
+}
+
+void PythonConnectionManager::setTelemetryPeriod(const DataVec &data) {
+
+    if(data.size() != 1) {
+        sendError(ServerCommand::INVALID_COMMAND_DATA);
+        return;
+    }
+
+    mTpxManager->setTelemetryPeriod(std::chrono::milliseconds(data[0]));
+    sendResponse({});
+
+}
+
+void PythonConnectionManager::executeBatch(const DataVec &data) {
+
+    // [flags][command code][data size][data...][command code][data size][data...]...; flag bit 0 stops at the first error
+    if(data.empty()) {
+        sendError(ServerCommand::INVALID_COMMAND_DATA);
+        return;
+    }
+
+    auto batch = std::make_shared<BatchReply>();
+    batch->client = mCurrentClient;
+    batch->stop_on_error = data[0] & 1;
+
+    std::size_t pos = 1;
+    while(pos < data.size()) {
+        if(data.size() - pos < 2 || data.size() - pos - 2 < data[pos + 1] || data[pos] == static_cast<std::uint32_t>(ServerCommand::BATCH)) {
+            sendError(ServerCommand::INVALID_COMMAND_DATA);
+            return;
+        }
+
+        batch->commands.emplace_back(data.begin() + pos, data.begin() + pos + 2 + data[pos + 1]);
+        batch->commands.back().erase(batch->commands.back().begin() + 1); // drop the size word
+        pos += 2 + data[pos + 1];
+    }
+
+    if(batch->commands.empty() || batch->commands.size() > MAX_BATCH_COMMANDS) {
+        sendError(ServerCommand::INVALID_COMMAND_DATA);
+        return;
+    }
+
+    batch->replies.resize(batch->commands.size());
+
+    if(batch->stop_on_error) {
+        batch->issued = 1;
+        runBatchCommand(batch, 0);
+    } else {
+        issueBatchCommands(batch);
+    }
+
+}
+
+void PythonConnectionManager::issueBatchCommands(const std::shared_ptr<BatchReply> &batch) {
+
+    // the Timepix queue keeps its commands in order, so a run of them can be pipelined; anything else could overtake
+    // the commands before it, so it waits for their replies, and the commands after it wait for its reply
+    auto is_timepix = [&batch](std::size_t index) {
+        auto code = static_cast<ServerCommand>(batch->commands[index][0]);
+        return COMMAND_MAP.contains(code) && !LOCAL_COMMANDS.contains(code);
+    };
+
+    auto first = batch->issued;
+    if(is_timepix(first)) {
+        while(batch->issued < batch->commands.size() && is_timepix(batch->issued))
+            ++batch->issued;
+    } else {
+        ++batch->issued;
+    }
+
+    // issued is set first, as a sub-command that replies straight away may issue the next ones itself
+    auto last = batch->issued;
+    for(auto i = first; i < last; ++i)
+        runBatchCommand(batch, i);
+
+}
+
+void PythonConnectionManager::runBatchCommand(const std::shared_ptr<BatchReply> &batch, std::size_t index) {
+
+    // each sub-command runs as if a client had sent it, but its reply is redirected into the batch
+    auto client = batch->client;
+    client.batch = batch;
+    client.batch_index = index;
+
+    const auto &command = batch->commands[index];
+    zmq::message_t msg(command.data(), command.size() * sizeof(std::uint32_t));
+
+    selectClient(client, ServerCommand::ERROR_OCCURED);
+    handleCommand(msg);
+
+}
+
+void PythonConnectionManager::collectBatchReply(zmq::message_t &payload) {
+
+    auto batch = mCurrentClient.batch;
+    auto index = mCurrentClient.batch_index;
+
+    auto words = static_cast<const std::uint32_t*>(payload.data());
+    batch->replies[index] = DataVec(words, words + payload.size() / sizeof(std::uint32_t));
+    ++batch->received;
+
+    auto &reply = batch->replies[index];
+    bool failed = reply.empty() || reply[0] >= static_cast<std::uint32_t>(ServerCommand::INVALID_COMMAND_DATA);
+
+    if(batch->stop_on_error) {
+        if(!failed && index + 1 < batch->commands.size()) {
+            batch->issued = index + 2;
+            runBatchCommand(batch, index + 1);
+            return;
+        }
+    } else if(batch->received < batch->commands.size()) {
+        if(batch->received == batch->issued)
+            issueBatchCommands(batch);
+        return;
+    }
+
+    // [number of replies][reply size][reply code][reply data...]...; a batch stopped early has fewer replies than commands
+    DataVec result {static_cast<std::uint32_t>(batch->received)};
+    for(std::size_t i = 0; i < batch->received; ++i) {
+        result.push_back(batch->replies[i].size());
+        result.insert(result.end(), batch->replies[i].begin(), batch->replies[i].end());
+    }
+
+    selectClient(batch->client, ServerCommand::BATCH);
+    sendResponse(result);
+
+}
+
+void PythonConnectionManager::runScan(const DataVec &data) {
+
+    // every image goes back in the one reply, so a scan here is shorter than one the server consumes itself
+    ScanSettings settings;
+    if(!settings.fromConfigWords(data) || settings.getValues().size() > ScanSettings::MAX_REPLY_STEPS) {
+        sendError(ServerCommand::INVALID_COMMAND_DATA);
+        return;
+    }
+
+    if(mThread.getHistogramScanSocket() == nullptr) {
+        sendError(ServerCommand::THREAD_NOT_STARTED);
+        return;
+    }
+
+    // the scan runs as one job, so it is ordered with the other Timepix commands and has the channel to itself
+    mTpxManager->queueJob(this, CommandJob::SCAN, data);
+
+}
+
+void PythonConnectionManager::equalize(const DataVec &data) {
+
+    EqualizationSettings settings;
+    if(!settings.fromConfigWords(data)) {
+        sendError(ServerCommand::INVALID_COMMAND_DATA);
+        return;
+    }
+
+    if(mThread.getHistogramScanSocket() == nullptr) {
+        sendError(ServerCommand::THREAD_NOT_STARTED);
+        return;
+    }
+
+    mTpxManager->queueJob(this, CommandJob::EQUALIZATION, data);
+
+}
+
 void PythonConnectionManager::bindUdpPort(const DataVec &data) {
 
     if(data.size() != 1) {
@@ -211,6 +495,8 @@ void PythonConnectionManager::bindUdpPort(const DataVec &data) {
         return;
     }
 
+    // the old UDP thread's command socket goes away with it, and any requests waiting on it with it
+    dropForwardedRequests(mThread.getUdpThreadSocket(), ServerCommand::THREAD_NOT_CONNECTED);
     mThread.bindUdpPort(data[0]);
 
     sendResponse({});
@@ -225,33 +511,81 @@ void PythonConnectionManager::setTcpServer(TimepixConnectionManager &tpx) {
 
 void PythonConnectionManager::forwardToSecondaryThread(zmq::socket_t *cmd_socket, zmq::message_t &msg) {
 
+    if(cmd_socket == nullptr) {
+        sendError(ServerCommand::THREAD_NOT_STARTED);
+        return;
+    } else if (!cmd_socket->handle()) {
+        sendError(ServerCommand::THREAD_NOT_CONNECTED);
+        return;
+    }
+
+    // the reply is picked up by pollForwardedRequests(), so a slow command doesn't hold up other clients
+    auto words = static_cast<const std::uint32_t*>(msg.data());
+    auto &queue = mForwardedRequests[cmd_socket];
+    queue.push_back({mCurrentClient, DataVec(words, words + msg.size() / sizeof(std::uint32_t))});
+
+    if(queue.size() == 1)
+        sendForwardedRequest(cmd_socket);
+
+}
+
+void PythonConnectionManager::sendForwardedRequest(zmq::socket_t *cmd_socket) {
+
+    DEBUG("Forwarding message to secondary thread");
+
     try {
+        cmd_socket->send(zmq::buffer(mForwardedRequests[cmd_socket].front().message), zmq::send_flags::none);
+    } catch (...) {
+        std::cout << "Error occurred while forwarding client command to secondary thread." << std::endl;
+        dropForwardedRequests(cmd_socket, ServerCommand::THREAD_NOT_CONNECTED);
+    }
 
-        if(cmd_socket == nullptr) {
-            sendError(ServerCommand::THREAD_NOT_STARTED);
-            return;
-        } else if (!cmd_socket->handle()) {
-            sendError(ServerCommand::THREAD_NOT_CONNECTED);
-            return;
-        }
+}
+
+void PythonConnectionManager::pollForwardedRequests() {
 
-        DEBUG("Forwarding message to secondary thread");
+    for(auto &[cmd_socket, queue] : mForwardedRequests) {
 
-        cmd_socket->send(msg, zmq::send_flags::none);
+        if(queue.empty())
+            continue;
 
         zmq::message_t response;
-        cmd_socket->recv(response);
+        try {
+            if(!cmd_socket->recv(response, zmq::recv_flags::dontwait))
+                continue;
+        } catch (...) {
+            std::cout << "Error occurred while receiving a secondary thread's response." << std::endl;
+            dropForwardedRequests(cmd_socket, ServerCommand::THREAD_NOT_CONNECTED);
+            continue;
+        }
 
         DEBUG("Received response from secondary thread");
 
-        mCommandSocket->send(response, zmq::send_flags::dontwait);
+        // the next request goes out before this reply is delivered, as delivering it can forward more requests
+        auto client = std::move(queue.front().client);
+        queue.pop_front();
+        if(!queue.empty())
+            sendForwardedRequest(cmd_socket);
 
-        DEBUG("Forwarded response to client");
+        selectClient(client, ServerCommand::ERROR_OCCURED);
+        sendToClient(response);
 
-    } catch (...) {
+    }
 
-        std::cout << "Error occurred while forwarding client command to secondary thread." << std::endl;
+}
+
+void PythonConnectionManager::dropForwardedRequests(zmq::socket_t *cmd_socket, ServerCommand errcode) {
+
+    // the queue is emptied rather than erased, as this can be called while the queues are being iterated
+    std::deque<ForwardedRequest> requests;
+    requests.swap(mForwardedRequests[cmd_socket]);
 
+    auto current_client = mCurrentClient;
+    auto current_command = mLastCommand;
+    for(const auto &request : requests) {
+        selectClient(request.client, errcode);
+        sendError(errcode);
     }
+    selectClient(current_client, current_command);
 
 }
@@ -0,0 +1,109 @@
+#include "server/RoiCounter.h"
+
+#include <algorithm>
+#include <bit>
+
+bool RoiTable::fromConfigWords(const std::uint32_t *words, std::size_t num_words) {
+
+    std::fill(masks.begin(), masks.end(), 0);
+    num_rois = 0;
+
+    std::size_t pos = 0;
+    while(pos < num_words) {
+
+        if(num_rois == MAX_ROIS)
+            return false;
+
+        std::uint64_t bit = static_cast<std::uint64_t>(1) << num_rois;
+
+        switch(words[pos]) {
+        case RECTANGLE: {
+            if(num_words - pos < 5)
+                return false;
+            auto x0 = words[pos+1], y0 = words[pos+2], x1 = words[pos+3], y1 = words[pos+4];
+            if(x0 >= x1 || y0 >= y1 || x1 > 256 || y1 > 256)
+                return false;
+            for(auto y = y0; y < y1; ++y)
+                for(auto x = x0; x < x1; ++x)
+                    masks[x + 256*y] |= bit;
+            pos += 5;
+            break;
+        }
+
+        case MASK:
+            if(num_words - pos < MASK_WORDS + 1)
+                return false;
+            for(std::size_t pixel = 0; pixel < masks.size(); ++pixel)
+                if((words[pos + 1 + pixel/32] >> (pixel % 32)) & 1)
+                    masks[pixel] |= bit;
+            pos += MASK_WORDS + 1;
+            break;
+
+        default:
+            return false;
+        }
+
+        ++num_rois;
+
+    }
+
+    return true;
+
+}
+
+void RoiCounter::setTable(std::shared_ptr<const RoiTable> table) {
+
+    mTable = std::move(table);
+    auto num_rois = mTable ? mTable->num_rois : 0;
+    mCounts.assign(num_rois, 0);
+    mTotals = std::vector<std::atomic<std::uint64_t>>(num_rois);
+    mCollected.assign(num_rois, 0);
+
+}
+
+void RoiCounter::addPackets(const std::uint64_t *data, std::size_t num_packets) {
+
+    if(mCounts.empty())
+        return;
+
+    const auto *masks = mTable->masks.data();
+    auto *counts = mCounts.data();
+
+    // one table lookup per hit; the (usually zero or one) regions it falls in are then visited bit by bit
+    for(std::size_t ix = 0; ix < num_packets; ++ix) {
+        auto packet = data[ix];
+        auto mask = masks[((packet >> 56) & 0xFF) + ((packet >> 48) & 0xFF)*256];
+        while(mask) {
+            ++counts[std::countr_zero(mask)];
+            mask &= mask - 1;
+        }
+    }
+
+    // one atomic add per region and batch, rather than per hit
+    for(std::size_t ix = 0; ix < mCounts.size(); ++ix) {
+        if(mCounts[ix]) {
+            mTotals[ix].fetch_add(mCounts[ix], std::memory_order_relaxed);
+            mCounts[ix] = 0;
+        }
+    }
+
+}
+
+void RoiCounter::collectInto(std::vector<std::uint64_t> &total) {
+
+    for(std::size_t ix = 0; ix < mTotals.size(); ++ix) {
+        auto now = mTotals[ix].load(std::memory_order_relaxed);
+        total[ix] += now - mCollected[ix];
+        mCollected[ix] = now;
+    }
+
+}
+
+void RoiCounter::clear() {
+
+    std::fill(mCounts.begin(), mCounts.end(), 0);
+    for(auto &t : mTotals)
+        t.store(0, std::memory_order_relaxed);
+    std::fill(mCollected.begin(), mCollected.end(), 0);
+
+}
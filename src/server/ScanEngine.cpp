@@ -0,0 +1,229 @@
+#include "server/ScanEngine.h"
+
+#include "server/TimepixCodes.h"
+#include "server/TimepixConnectionManager.h"
+
+bool ScanSettings::fromConfigWords(const DataVec &words) {
+
+    if(words.size() != CONFIG_WORDS || words[4] > static_cast<std::uint32_t>(DwellMode::COUNTS))
+        return false;
+
+    dac_code = words[0];
+    first = words[1];
+    last = words[2];
+    step = words[3];
+    mode = static_cast<DwellMode>(words[4]);
+    dwell = words[5];
+    settle_ms = words[6];
+    product = words[7];
+
+    if(step == 0 || dac_code > 0xFFFF || first > MAX_DAC_VALUE || last > MAX_DAC_VALUE || dwell == 0)
+        return false;
+    if(mode == DwellMode::TIME && dwell > MAX_DWELL_MS)
+        return false;
+
+    auto span = first > last ? first - last : last - first;
+    return span / step + 1 <= MAX_STEPS;
+
+}
+
+std::vector<std::uint32_t> ScanSettings::getValues() const {
+
+    std::vector<std::uint32_t> values;
+
+    if(first <= last) {
+        for(std::uint32_t value = first; value <= last; value += step)
+            values.push_back(value);
+    } else {
+        for(std::uint32_t value = first; value >= last && value <= first; value -= step)
+            values.push_back(value);
+    }
+
+    return values;
+
+}
+
+ScanEngine::ScanEngine(TimepixConnectionManager &tpx, zmq::socket_t *histogram_socket, const ScanSettings &settings) :
+    mTpx(tpx),
+    mHistogramSocket(histogram_socket),
+    mSettings(settings) {
+
+    // do nothing
+
+}
+
+asio::awaitable<bool> ScanEngine::run(std::function<bool()> should_stop, DataVec &result) {
+
+    auto num_steps = mSettings.getValues().size();
+
+    result.clear();
+    result.reserve(1 + num_steps * (1 + 256*256));
+    result.push_back(num_steps);
+
+    co_return co_await run(std::move(should_stop), [&result](std::uint32_t value, const DataVec &image) {
+        result.push_back(value);
+        result.insert(result.end(), image.begin(), image.end());
+    });
+
+}
+
+asio::awaitable<bool> ScanEngine::run(std::function<bool()> should_stop, StepHandler on_step) {
+
+    // the DAC is put back where it was afterwards, whether or not the steps succeed
+    auto original = co_await readDac();
+    if(should_stop())
+        co_return false;
+    if(!original) {
+        mError = "the DAC could not be read";
+        co_return false;
+    }
+
+    bool succeeded = co_await runSteps(should_stop, on_step);
+    if(should_stop())
+        co_return false; // the connection is gone, so there's nothing to restore it through
+
+    bool restored = co_await setDac(*original);
+    if(!restored && succeeded)
+        mError = "the DAC could not be set back to " + std::to_string(*original);
+    co_return succeeded && restored;
+
+}
+
+asio::awaitable<bool> ScanEngine::runSteps(const std::function<bool()> &should_stop, const StepHandler &on_step) {
+
+    auto start = std::chrono::steady_clock::now();
+
+    for(auto value : mSettings.getValues()) {
+
+        // the scan has the Timepix to itself while it runs, so it isn't allowed to run for ever
+        if(std::chrono::steady_clock::now() - start > MAX_SCAN_DURATION) {
+            mError = "the scan took longer than " + std::to_string(MAX_SCAN_DURATION.count()) + " minutes";
+            co_return false;
+        }
+
+        if(!co_await setDac(value) || should_stop()) {
+            mError = "the SPIDR did not accept DAC value " + std::to_string(value);
+            co_return false;
+        }
+
+        co_await wait(std::chrono::milliseconds(mSettings.settle_ms));
+        if(should_stop())
+            co_return false;
+
+        if(!requestHistogram(ServerCommand::SET_SCAN_GATE, DataVec{1, mSettings.product})) {
+            mError = "the histogram thread did not open the scan gate";
+            co_return false;
+        }
+
+        if(!co_await dwell(should_stop)) {
+            requestHistogram(ServerCommand::SET_SCAN_GATE, DataVec(1, 0)); // don't leave the gate counting
+            co_return false;
+        }
+
+        auto image = requestHistogram(ServerCommand::SET_SCAN_GATE, DataVec(1, 0));
+        if(!image) {
+            mError = "the histogram thread did not return the step's image";
+            co_return false;
+        }
+
+        on_step(value, *image);
+
+    }
+
+    co_return true;
+
+}
+
+asio::awaitable<std::optional<std::uint32_t>> ScanEngine::readDac() {
+
+    auto reply = co_await mTpx.execute(TpxCommand::CMD_GET_DAC, DataVec(1, mSettings.dac_code), DAC_DEADLINE);
+    if(!reply || reply->error || reply->data.size() != 1 || (reply->data[0] >> 16) != mSettings.dac_code)
+        co_return std::nullopt;
+
+    co_return reply->data[0] & ScanSettings::MAX_DAC_VALUE;
+
+}
+
+asio::awaitable<bool> ScanEngine::setDac(std::uint32_t value) {
+
+    // the SET_DAC word holds the DAC code in its top half
+    DataVec dac_word(1, (mSettings.dac_code << 16) | value);
+    auto reply = co_await mTpx.execute(TpxCommand::CMD_SET_DAC, std::move(dac_word), DAC_DEADLINE);
+    co_return reply && !reply->error;
+
+}
+
+asio::awaitable<bool> ScanEngine::dwell(const std::function<bool()> &should_stop) {
+
+    if(mSettings.mode == ScanSettings::DwellMode::TIME) {
+        co_await wait(std::chrono::milliseconds(mSettings.dwell));
+        co_return !should_stop();
+    }
+
+    // counting mode polls the gate until enough hits have arrived, giving up on a step that never gets them; if the
+    // count stops rising altogether no hits are arriving ( readout isn't running ), and the whole scan gives up
+    auto start = std::chrono::steady_clock::now();
+    auto last_rise = start;
+    std::uint64_t last_count = 0;
+    while(std::chrono::steady_clock::now() - start < MAX_COUNT_WAIT) {
+        co_await wait(COUNT_POLL_PERIOD);
+        if(should_stop())
+            co_return false;
+
+        auto count = requestHistogram(ServerCommand::GET_SCAN_GATE_COUNT, DataVec());
+        if(!count || count->size() != 2) {
+            mError = "the histogram thread did not return the scan gate count";
+            co_return false;
+        }
+
+        auto total = (*count)[0] | (static_cast<std::uint64_t>((*count)[1]) << 32);
+        if(total >= mSettings.dwell)
+            co_return true;
+
+        auto now = std::chrono::steady_clock::now();
+        if(total > last_count) {
+            last_count = total;
+            last_rise = now;
+        } else if(now - last_rise > COUNT_STALL_TIMEOUT) {
+            mError = "no hits arrived for " + std::to_string(COUNT_STALL_TIMEOUT.count()) + " ms; readout has to be running during a scan";
+            co_return false;
+        }
+    }
+
+    co_return true; // the step keeps what it has, so one dead step doesn't lose the whole scan
+
+}
+
+const std::string& ScanEngine::getError() const {
+
+    return mError;
+
+}
+
+asio::awaitable<void> ScanEngine::wait(std::chrono::milliseconds duration) {
+
+    asio::steady_timer timer(co_await asio::this_coro::executor, duration);
+    co_await timer.async_wait(asio::as_tuple(asio::use_awaitable));
+
+}
+
+std::optional<DataVec> ScanEngine::requestHistogram(ServerCommand cmd, const DataVec &data) {
+
+    if(mHistogramSocket == nullptr || !mHistogramSocket->handle())
+        return std::nullopt;
+
+    DataVec request {static_cast<std::uint32_t>(cmd)};
+    request.insert(request.end(), data.begin(), data.end());
+    mHistogramSocket->send(zmq::buffer(request), zmq::send_flags::none);
+
+    zmq::message_t response;
+    if(!mHistogramSocket->recv(response) || response.size() < sizeof(std::uint32_t))
+        return std::nullopt;
+
+    auto words = static_cast<const std::uint32_t*>(response.data());
+    if(words[0] != static_cast<std::uint32_t>(cmd))
+        return std::nullopt; // an error code
+
+    return DataVec(words + 1, words + response.size() / sizeof(std::uint32_t));
+
+}
@@ -34,6 +34,10 @@ std::string SecondaryThread::getCommandServerAddress() {
 std::unique_ptr<zmq::socket_t> SecondaryThread::getCommandClient(){
 
     auto socket = std::make_unique<zmq::socket_t>(mParent.getZmq(), zmq::socket_type::req);
+    // replies are collected asynchronously, so a request whose reply was never collected ( the client manager was reset
+    // while it was outstanding ) mustn't wedge the socket; the late reply is dropped instead
+    socket->set(zmq::sockopt::req_relaxed, true);
+    socket->set(zmq::sockopt::req_correlate, true);
     socket->connect(getCommandServerAddress());
 
     /*
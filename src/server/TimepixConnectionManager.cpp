@@ -4,11 +4,14 @@
 #include <iomanip>
 #include <iostream>
 #include <map>
+#include <set>
 #include <chrono>
 #include <thread>
 
 #include "server/CommsThread.h"
 #include "server/PythonConnectionManager.h"
+#include "server/Equalizer.h"
+#include "server/ScanEngine.h"
 
 const std::map<TpxCommand, void (TimepixConnectionManager::*)(const DataVec &)> HANDLER_MAP {
     {TpxCommand::CMD_NOP, &TimepixConnectionManager::genericHandler<1>},
@@ -16,12 +19,12 @@ const std::map<TpxCommand, void (TimepixConnectionManager::*)(const DataVec &)>
     {TpxCommand::CMD_GET_FIRMWVERSION, &TimepixConnectionManager::genericHandler<1>},
     {TpxCommand::CMD_GET_CHIPBOARDID, &TimepixConnectionManager::genericHandler<1>},
     {TpxCommand::CMD_GET_DEVICEIDS, &TimepixConnectionManager::genericHandler<4>},
-    {TpxCommand::CMD_GET_LOCALTEMP, &TimepixConnectionManager::genericHandler<1>},
+    {TpxCommand::CMD_GET_LOCALTEMP, &TimepixConnectionManager::telemetryHandler<TpxCommand::CMD_GET_LOCALTEMP>},
     {TpxCommand::CMD_GET_REMOTETEMP, &TimepixConnectionManager::genericHandler<1>},
-    {TpxCommand::CMD_GET_FPGATEMP, &TimepixConnectionManager::genericHandler<1>},
-    {TpxCommand::CMD_GET_FANSPEED, &TimepixConnectionManager::genericHandler<1>},
-    {TpxCommand::CMD_GET_PRESSURE, &TimepixConnectionManager::genericHandler<1>},
-    {TpxCommand::CMD_GET_HUMIDITY, &TimepixConnectionManager::genericHandler<1>},
+    {TpxCommand::CMD_GET_FPGATEMP, &TimepixConnectionManager::telemetryHandler<TpxCommand::CMD_GET_FPGATEMP>},
+    {TpxCommand::CMD_GET_FANSPEED, &TimepixConnectionManager::telemetryHandler<TpxCommand::CMD_GET_FANSPEED>},
+    {TpxCommand::CMD_GET_PRESSURE, &TimepixConnectionManager::telemetryHandler<TpxCommand::CMD_GET_PRESSURE>},
+    {TpxCommand::CMD_GET_HUMIDITY, &TimepixConnectionManager::telemetryHandler<TpxCommand::CMD_GET_HUMIDITY>},
     {TpxCommand::CMD_GET_SPIDR_ADC, &TimepixConnectionManager::genericHandler<1>},
     {TpxCommand::CMD_SET_BIAS_ADJUST, &TimepixConnectionManager::genericHandler<1>},
     {TpxCommand::CMD_BIAS_SUPPLY_ENA, &TimepixConnectionManager::genericHandler<1>},
@@ -57,6 +60,59 @@ const std::map<TpxCommand, void (TimepixConnectionManager::*)(const DataVec &)>
     {TpxCommand::CMD_SET_SENSEDAC, &TimepixConnectionManager::genericHandler<1>}
 };
 
+// reads that can safely be sent again if their reply is lost
+const std::set<TpxCommand> IDEMPOTENT_COMMANDS {
+    TpxCommand::CMD_NOP,
+    TpxCommand::CMD_GET_SOFTWVERSION,
+    TpxCommand::CMD_GET_FIRMWVERSION,
+    TpxCommand::CMD_GET_CHIPBOARDID,
+    TpxCommand::CMD_GET_DEVICEIDS,
+    TpxCommand::CMD_GET_LOCALTEMP,
+    TpxCommand::CMD_GET_REMOTETEMP,
+    TpxCommand::CMD_GET_FPGATEMP,
+    TpxCommand::CMD_GET_FANSPEED,
+    TpxCommand::CMD_GET_PRESSURE,
+    TpxCommand::CMD_GET_HUMIDITY,
+    TpxCommand::CMD_GET_SPIDR_ADC,
+    TpxCommand::CMD_GET_DEVICEPORT,
+    TpxCommand::CMD_GET_SERVERPORT,
+    TpxCommand::CMD_GET_SPIDRREG,
+    TpxCommand::CMD_GET_PLLCONFIG,
+    TpxCommand::CMD_GET_HEADERFILTER,
+    TpxCommand::CMD_GET_GENCONFIG,
+    TpxCommand::CMD_GET_TPPERIODPHASE,
+    TpxCommand::CMD_GET_TRIGCONFIG,
+    TpxCommand::CMD_GET_DAC,
+    TpxCommand::CMD_GET_PIXCONF,
+    TpxCommand::CMD_GET_READOUTSPEED
+};
+
+// slow-control readings kept in the telemetry cache
+const std::vector<TpxCommand> TELEMETRY_COMMANDS {
+    TpxCommand::CMD_GET_LOCALTEMP,
+    TpxCommand::CMD_GET_FPGATEMP,
+    TpxCommand::CMD_GET_FANSPEED,
+    TpxCommand::CMD_GET_HUMIDITY,
+    TpxCommand::CMD_GET_PRESSURE
+};
+
+// SET commands whose data is also the reply to the matching GET, so a successful SET can answer later GETs
+const std::map<TpxCommand, TpxCommand> CACHED_REGISTERS {
+    {TpxCommand::CMD_SET_DAC, TpxCommand::CMD_GET_DAC},
+    {TpxCommand::CMD_SET_PLLCONFIG, TpxCommand::CMD_GET_PLLCONFIG},
+    {TpxCommand::CMD_SET_GENCONFIG, TpxCommand::CMD_GET_GENCONFIG},
+    {TpxCommand::CMD_SET_HEADERFILTER, TpxCommand::CMD_GET_HEADERFILTER},
+    {TpxCommand::CMD_SET_TRIGCONFIG, TpxCommand::CMD_GET_TRIGCONFIG},
+    {TpxCommand::CMD_SET_SPIDRREG, TpxCommand::CMD_GET_SPIDRREG}
+};
+
+// commands which take the SPIDR longer than DEFAULT_DEADLINE to answer
+const std::map<TpxCommand, std::chrono::milliseconds> COMMAND_DEADLINES {
+    {TpxCommand::CMD_RESET_PIXELS, std::chrono::milliseconds(5000)},
+    {TpxCommand::CMD_SET_PIXCONF, std::chrono::milliseconds(2000)},
+    {TpxCommand::CMD_GET_PIXCONF, std::chrono::milliseconds(2000)}
+};
+
 TimepixConnectionManager::TimepixConnectionManager(CommsThread &parent_thread, const std::deque<TimepixCommandInfo> &queue) :
     mThread(parent_thread),
     mQueuedCommands(queue) {
@@ -74,6 +130,8 @@ TimepixConnectionManager::~TimepixConnectionManager() {
 
 void TimepixConnectionManager::terminateConnection() {
 
+    cancelPendingReplies();
+
     if(mTpxSocket && mTpxSocket->is_open()) {
         try {
             mTpxSocket->cancel();
@@ -91,29 +149,42 @@ void TimepixConnectionManager::terminateConnection() {
         }
     }
     mIsConnected = false;
+    mIsWriting = false;
+    mWriteQueue.clear();
+    mRecvBuffer.clear();
 }
 
 void TimepixConnectionManager::poll() {
 
     try {
 
-        if(mIsConnected && !mIsExecutingCommand && !mQueuedCommands.empty()) {
-            auto next_command = mQueuedCommands.front();
-
-            sendCommand(next_command.command, next_command.data);
-            mLastCommandSource = next_command.sender;
-
-            if(next_command.command == TpxCommand::CMD_RESET_MODULE) {
-                terminateConnection();
-                mLastCommandSource->sendResponse({}); // this server is going to die, so send a response to keep ZMQ happy
-                mQueuedCommands.pop_front();
-                mThread.sendLog("Resetting Timepix connection");
-                mLastCommandSource = nullptr;
-                DEBUG("Resetting Timepix connection due to SPIDR reset");
-                std::this_thread::sleep_for(std::chrono::milliseconds(1000));
-                attemptConnection(mLastHostIp, mLastHostPort, mLastServerIp, mLastServerPort, true);
-                return;
+        while(mIsConnected && !mQueuedCommands.empty() && mActiveCommands.size() < MAX_IN_FLIGHT && !isChannelHeld()) {
+
+            const auto &next = mQueuedCommands.front();
+
+            if(next.job == CommandJob::TPX_COMMAND && next.command == TpxCommand::CMD_RESET_MODULE) {
+                // the commands sent before the reset have to finish first, and the reset is written synchronously, so
+                // nothing else may be part-way through a write
+                if(mActiveCommands.empty() && !mIsWriting && mWriteQueue.empty()) {
+                    resetModule();
+                    return;
+                }
+                break;
             }
+
+            if(next.job != CommandJob::TPX_COMMAND && !mActiveCommands.empty())
+                break; // a job waits for the commands sent before it
+
+            auto command = std::make_shared<ActiveCommand>(std::move(mQueuedCommands.front()));
+            mQueuedCommands.pop_front();
+            mActiveCommands.push_back(command);
+
+            // errors thrown inside the coroutine are rethrown out of poll(), like any other handler
+            asio::co_spawn(*mAsioIO, runCommand(std::move(command)), [](std::exception_ptr ex) {
+                if(ex)
+                    std::rethrow_exception(ex);
+            });
+
         }
 
         mAsioIO->poll();
@@ -134,6 +205,30 @@ void TimepixConnectionManager::poll() {
 
 }
 
+void TimepixConnectionManager::resetModule() {
+
+    auto next_command = std::move(mQueuedCommands.front());
+    mQueuedCommands.pop_front();
+
+    invalidatePixelConfig(); // the reset clears the chip's pixel configuration
+    invalidateRegisterCache();
+
+    // written synchronously, as the connection is closed straight afterwards
+    auto message = buildMessage(next_command.command, next_command.data);
+    asio::write(*mTpxSocket, asio::buffer(message));
+
+    terminateConnection();
+    mLastCommandSource = next_command.sender;
+    mLastCommandSource->selectClient(next_command.client, next_command.reply_code);
+    mLastCommandSource->sendResponse({}); // this server is going to die, so send a response to keep ZMQ happy
+    mThread.sendLog("Resetting Timepix connection");
+    mLastCommandSource = nullptr;
+    DEBUG("Resetting Timepix connection due to SPIDR reset");
+    std::this_thread::sleep_for(std::chrono::milliseconds(1000));
+    attemptConnection(mLastHostIp, mLastHostPort, mLastServerIp, mLastServerPort, true);
+
+}
+
 void TimepixConnectionManager::attemptConnection(const std::string &host_ip, int host_port, const std::string &server_ip, int server_port, bool wait) {
 
     mAsioIO = std::make_unique<asio::io_context>();
@@ -188,12 +283,20 @@ void TimepixConnectionManager::initializeConnection(const asio::error_code &err)
         throw asio::system_error(err);
 
     mIsConnected = true;
-    mIsExecutingCommand = false;
+    invalidateRegisterCache(); // the registers may have been changed by someone else while disconnected
 
     while(mTpxSocket->available()) {
-        mTpxSocket->read_some(asio::buffer(mResponseBuffer));
+        mTpxSocket->read_some(asio::buffer(mReadChunk));
     }
 
+    mRecvBuffer.clear();
+    startReading();
+
+    asio::co_spawn(*mAsioIO, refreshTelemetry(), [](std::exception_ptr ex) {
+        if(ex)
+            std::rethrow_exception(ex);
+    });
+
     mThread.sendLog("Successfully connected.");
     DEBUG("New TCP connection established");
 
@@ -207,7 +310,7 @@ bool TimepixConnectionManager::isConnected() const {
 
 bool TimepixConnectionManager::isExecutingCommand() const {
 
-    return mIsExecutingCommand;
+    return !mActiveCommands.empty();
 
 }
 
@@ -216,21 +319,29 @@ void TimepixConnectionManager::queueCommand(PythonConnectionManager *sender, Tpx
     mQueuedCommands.push_back({
         .command = command,
         .data = std::move(data),
-        .sender = sender
+        .sender = sender,
+        .client = sender->getCurrentClient(),
+        .reply_code = sender->getCurrentCommand()
     });
 
 }
 
-void TimepixConnectionManager::sendCommand(TpxCommand cmd, const DataVec &data, bool noreply) {
+void TimepixConnectionManager::queueJob(PythonConnectionManager *sender, CommandJob job, DataVec data) {
 
-    if(mIsCancelled)
-        return;
+    mQueuedCommands.push_back({
+        .command = TpxCommand::CMD_NOP, // a job sends its own commands
+        .data = std::move(data),
+        .sender = sender,
+        .client = sender->getCurrentClient(),
+        .reply_code = sender->getCurrentCommand(),
+        .job = job
+    });
 
-    if(noreply)
-        cmd = static_cast<TpxCommand>( static_cast<uint32_t>(cmd) & static_cast<uint32_t>(TpxCommand::CMD_NOREPLY) );
+}
+
+DataVec TimepixConnectionManager::buildMessage(TpxCommand cmd, const DataVec &data) {
 
     std::size_t msg_size = std::max<std::size_t>(4 + data.size(), 5);
-    std::size_t byte_size = msg_size * sizeof(std::uint32_t);
     DataVec message(msg_size);
 
     message[0] = io::htonl(static_cast<uint32_t>(cmd));
@@ -241,19 +352,447 @@ void TimepixConnectionManager::sendCommand(TpxCommand cmd, const DataVec &data,
     if(data.empty()) {
         message[4] = 0;
     } else {
-        for(auto i = 0; i < data.size(); ++i)
+        for(std::size_t i = 0; i < data.size(); ++i)
             message[4+i] = io::htonl(data[i]);
     }
 
-    std::memcpy(mCommandBuffer.data(), message.data(), byte_size);
+    return message;
+
+}
+
+asio::awaitable<void> TimepixConnectionManager::runCommand(std::shared_ptr<ActiveCommand> command) {
+
+    const auto &info = command->info;
+
+    if(info.job == CommandJob::PIXEL_UPLOAD) {
+        co_await runPixelConfigUpload(std::move(command));
+        co_return;
+    }
+
+    if(info.job == CommandJob::SCAN) {
+        co_await runScan(std::move(command));
+        co_return;
+    }
+
+    if(info.job == CommandJob::EQUALIZATION) {
+        co_await runEqualization(std::move(command));
+        co_return;
+    }
+
+    // anything else that writes the pixel matrix leaves the shadow out of date
+    if(info.command == TpxCommand::CMD_SET_PIXCONF || info.command == TpxCommand::CMD_RESET_PIXELS)
+        invalidatePixelConfig();
+
+    auto deadline = DEFAULT_DEADLINE;
+    if(COMMAND_DEADLINES.contains(info.command))
+        deadline = COMMAND_DEADLINES.at(info.command);
+
+    std::size_t attempts = IDEMPOTENT_COMMANDS.contains(info.command) ? MAX_READ_ATTEMPTS : 1;
+
+    // the telemetry age flag is for this server, not the SPIDR
+    bool is_telemetry = std::find(TELEMETRY_COMMANDS.begin(), TELEMETRY_COMMANDS.end(), info.command) != TELEMETRY_COMMANDS.end();
+    DataVec request = is_telemetry ? DataVec() : info.data;
+
+    std::optional<Reply> reply;
+    for(std::size_t attempt = 0; attempt < attempts && !reply; ++attempt) {
+        if(attempt)
+            mThread.sendWarn("No reply from the Timepix; retrying (attempt " + std::to_string(attempt + 1) + ")");
+
+        reply = co_await execute(info.command, request, deadline);
+
+        if(mIsCancelled || command->finished)
+            co_return; // the client has already been told the command failed
+    }
+
+    finishCommand(*command);
+
+    if(!reply) {
+        std::stringstream ss;
+        ss << std::hex << std::uppercase << static_cast<std::uint32_t>(info.command);
+        mThread.sendErr("Timed out waiting for a reply from the Timepix (command=0x" + ss.str() + ")");
+        info.sender->selectClient(info.client, info.reply_code);
+        info.sender->sendError(ServerCommand::ERROR_OCCURED);
+        co_return;
+    }
+
+    processRecv(info, *reply);
+
+}
+
+asio::awaitable<void> TimepixConnectionManager::runPixelConfigUpload(std::shared_ptr<ActiveCommand> command) {
+
+    const auto &info = command->info;
+    auto start = std::chrono::steady_clock::now();
+
+    auto columns_sent = co_await uploadPixelMatrix(info.data);
+
+    if(mIsCancelled || command->finished)
+        co_return;
+
+    finishCommand(*command);
+    info.sender->selectClient(info.client, info.reply_code);
+
+    if(!columns_sent) {
+        mThread.sendErr("The Timepix did not confirm the pixel configuration");
+        info.sender->sendError(ServerCommand::ERROR_OCCURED);
+        co_return;
+    }
+
+    auto elapsed_us = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+    mThread.sendLog("Uploaded " + std::to_string(*columns_sent) + " pixel configuration columns in " + std::to_string(elapsed_us / 1000) + " ms");
+    info.sender->sendResponse({static_cast<std::uint32_t>(elapsed_us), static_cast<std::uint32_t>(*columns_sent)});
+
+}
+
+asio::awaitable<std::optional<std::size_t>> TimepixConnectionManager::uploadPixelMatrix(const DataVec &matrix) {
+
+    auto column_begin = [&matrix](std::size_t col) {
+        return matrix.begin() + col * PIXEL_CONFIG_COLUMN_WORDS;
+    };
+
+    // only the columns which differ from the matrix the chip already holds are sent
+    std::vector<std::size_t> changed;
+    for(std::size_t col = 0; col < PIXEL_CONFIG_COLUMNS; ++col) {
+        if(!mPixelConfigShadow || !std::equal(column_begin(col), column_begin(col + 1), mPixelConfigShadow->begin() + col * PIXEL_CONFIG_COLUMN_WORDS))
+            changed.push_back(col);
+    }
+
+    if(changed.empty())
+        co_return 0;
+
+    mPixelConfigShadow.reset(); // the chip holds a mix of the two until the upload is confirmed
+
+    // every column but the last is streamed without waiting for a reply
+    DataVec column(PIXEL_CONFIG_COLUMN_WORDS + 1);
+    for(auto col : changed) {
+        column[0] = col;
+        std::copy(column_begin(col), column_begin(col + 1), column.begin() + 1);
+        if(col != changed.back())
+            sendCommand(TpxCommand::CMD_SET_PIXCONF, column, true);
+    }
+
+    // the SPIDR handles commands in order, so the reply to the last column confirms the whole matrix
+    auto reply = co_await execute(TpxCommand::CMD_SET_PIXCONF, column, COMMAND_DEADLINES.at(TpxCommand::CMD_SET_PIXCONF));
+    if(!reply || reply->error)
+        co_return std::nullopt;
+
+    mPixelConfigShadow = matrix;
+    co_return changed.size();
+
+}
+
+asio::awaitable<void> TimepixConnectionManager::runEqualization(std::shared_ptr<ActiveCommand> command) {
+
+    const auto &info = command->info;
+
+    EqualizationSettings settings;
+    settings.fromConfigWords(info.data); // already checked when the command was queued
+
+    auto should_stop = [this, command]() { return mIsCancelled || command->finished; };
+    auto phase_start = std::chrono::steady_clock::now();
+    DataVec phase_us;
+    auto end_phase = [&phase_start, &phase_us]() {
+        auto now = std::chrono::steady_clock::now();
+        phase_us.push_back(std::chrono::duration_cast<std::chrono::microseconds>(now - phase_start).count());
+        phase_start = now;
+    };
+
+    const auto previous = mPixelConfigShadow; // put back if the equalization fails, when it is known
+
+    // the same threshold scan at each end of the trim range, every pixel unmasked
+    std::vector<std::vector<std::int32_t>> edges;
+    std::string failure {};
+    for(auto trim : {std::uint8_t(0), Equalizer::MAX_TRIM}) {
+
+        mThread.sendLog("Equalization: scanning with every pixel at trim " + std::to_string(trim));
+
+        std::vector<std::uint8_t> pixels(Equalizer::NUM_PIXELS, Equalizer::getPixelConfig(trim, false));
+        auto uploaded = co_await uploadPixelMatrix(Equalizer::packPixelConfig(pixels));
+        if(should_stop())
+            co_return;
+        end_phase();
+
+        NoiseEdgeFinder finder(settings.noise_counts);
+        bool scanned = false;
+        std::string scan_error = "the pixel configuration could not be uploaded";
+        if(uploaded) {
+            ScanEngine engine(*this, mThread.getHistogramScanSocket(), settings.scan);
+            scanned = co_await engine.run(should_stop, [&finder](std::uint32_t value, const DataVec &image) {
+                finder.addStep(value, image);
+            });
+            if(should_stop())
+                co_return;
+            scan_error = engine.getError();
+        }
+        end_phase();
+
+        if(!scanned) {
+            failure = "Equalization failed during the trim " + std::to_string(trim) + " scan: " + scan_error;
+            break;
+        }
+
+        edges.push_back(finder.getEdges());
+
+    }
+
+    if(!failure.empty()) {
+        // the chip is left holding one of the uniform trim matrices unless the old one can be put back
+        bool restored = false;
+        if(previous) {
+            restored = (co_await uploadPixelMatrix(*previous)).has_value();
+            if(should_stop())
+                co_return;
+        }
+
+        finishCommand(*command);
+        mThread.sendErr(failure + (restored ? "; the previous pixel configuration was restored" : "; the pixel configuration has to be uploaded again"));
+        info.sender->selectClient(info.client, info.reply_code);
+        info.sender->sendError(ServerCommand::ERROR_OCCURED);
+        co_return;
+    }
+
+    Equalizer equalizer;
+    equalizer.compute(edges[0], edges[1]);
+    auto matrix = equalizer.getPixelConfig();
+    end_phase();
+
+    // the result replaces the trim 15 matrix on the chip, so an equalization leaves the chip equalized
+    bool uploaded = (co_await uploadPixelMatrix(matrix)).has_value();
+    if(should_stop())
+        co_return;
+    end_phase();
+
+    finishCommand(*command);
+
+    if(uploaded)
+        mThread.sendLog("Equalization finished; " + std::to_string(equalizer.getNumMasked()) + " pixels masked");
+    else
+        mThread.sendErr("Equalization finished, but the result could not be uploaded; the pixel configuration has to be uploaded again");
+
+    // [upload, scan, upload, scan, compute, upload times in us][number of masked pixels][1 if the chip holds the
+    // result][pixel configuration...]
+    DataVec result = phase_us;
+    result.push_back(equalizer.getNumMasked());
+    result.push_back(uploaded);
+    result.insert(result.end(), matrix.begin(), matrix.end());
+
+    info.sender->selectClient(info.client, info.reply_code);
+    info.sender->sendResponse(result);
+
+}
+
+asio::awaitable<void> TimepixConnectionManager::runScan(std::shared_ptr<ActiveCommand> command) {
+
+    const auto &info = command->info;
+
+    ScanSettings settings;
+    settings.fromConfigWords(info.data); // already checked when the command was queued
+
+    mThread.sendLog("Starting a scan of DAC " + std::to_string(settings.dac_code) + " over " + std::to_string(settings.getValues().size()) + " steps");
+
+    ScanEngine engine(*this, mThread.getHistogramScanSocket(), settings);
+    DataVec result;
+    bool succeeded = co_await engine.run([this, command]() { return mIsCancelled || command->finished; }, result);
+
+    if(mIsCancelled || command->finished)
+        co_return;
+
+    finishCommand(*command);
+    info.sender->selectClient(info.client, info.reply_code);
+
+    if(!succeeded) {
+        mThread.sendErr("DAC scan failed after " + std::to_string(result.empty() ? 0 : (result.size() - 1) / (1 + 256*256)) + " steps: " + engine.getError());
+        info.sender->sendError(ServerCommand::ERROR_OCCURED);
+        co_return;
+    }
+
+    mThread.sendLog("Scan finished");
+    info.sender->sendResponse(result);
+
+}
+
+void TimepixConnectionManager::invalidatePixelConfig() {
+
+    mPixelConfigShadow.reset();
+
+}
+
+bool TimepixConnectionManager::answerFromRegisterCache(PythonConnectionManager *sender, TpxCommand command, const DataVec &data) {
+
+    // only DAC and SPIDR register reads pick out a register
+    std::pair<TpxCommand, std::uint32_t> entry {command, data.empty() ? 0 : data[0]};
+    if(!mRegisterCache.contains(entry))
+        return false;
+
+    // the cache only changes once a SET's reply arrives, so a GET behind a SET of the same register waits its turn
+    auto writes_entry = [&entry](TpxCommand cmd, const DataVec &request) {
+        return getRegisterCacheEntry(cmd, request) == entry;
+    };
+    for(const auto &info : mQueuedCommands) {
+        if(info.job == CommandJob::TPX_COMMAND && writes_entry(info.command, info.data))
+            return false;
+    }
+    for(const auto &active : mActiveCommands) {
+        if(active->info.job == CommandJob::TPX_COMMAND && writes_entry(active->info.command, active->info.data))
+            return false;
+    }
+    for(const auto &pending : mPendingReplies) {
+        if(writes_entry(pending->command, pending->request))
+            return false;
+    }
+
+    sender->sendResponse(mRegisterCache.at(entry));
+    return true;
+
+}
+
+std::optional<std::pair<TpxCommand, std::uint32_t>> TimepixConnectionManager::getRegisterCacheEntry(TpxCommand cmd, const DataVec &data) {
+
+    if(!CACHED_REGISTERS.contains(cmd) || data.empty())
+        return std::nullopt;
+
+    // the DAC code is in the top half of the SET_DAC word, next to its value
+    std::uint32_t key = 0;
+    if(cmd == TpxCommand::CMD_SET_DAC)
+        key = data[0] >> 16;
+    else if(cmd == TpxCommand::CMD_SET_SPIDRREG)
+        key = data[0];
+
+    return std::make_pair(CACHED_REGISTERS.at(cmd), key);
+
+}
+
+void TimepixConnectionManager::updateRegisterCache(TpxCommand cmd, const DataVec &data, bool succeeded) {
+
+    auto entry = getRegisterCacheEntry(cmd, data);
+    if(!entry)
+        return;
+
+    if(succeeded)
+        mRegisterCache[*entry] = data;
+    else
+        mRegisterCache.erase(*entry);
+
+}
+
+void TimepixConnectionManager::invalidateRegisterCache() {
+
+    mRegisterCache.clear();
+
+}
+
+void TimepixConnectionManager::setTelemetryPeriod(std::chrono::milliseconds period) {
+
+    mTelemetryPeriod = period;
+    if(period.count() == 0)
+        mTelemetry.clear();
+
+}
+
+bool TimepixConnectionManager::answerFromTelemetry(PythonConnectionManager *sender, TpxCommand command, bool with_age) {
+
+    if(!mTelemetry.contains(command))
+        return false;
+
+    // a value that missed a couple of refreshes is stale; fetch it from the SPIDR instead
+    const auto &cached = mTelemetry.at(command);
+    auto age = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - cached.time);
+    if(mTelemetryPeriod.count() == 0 || age > 2 * mTelemetryPeriod)
+        return false;
+
+    if(with_age)
+        sender->sendResponse({cached.value, static_cast<std::uint32_t>(age.count())});
+    else
+        sender->sendResponse({cached.value});
+    return true;
+
+}
+
+asio::awaitable<void> TimepixConnectionManager::refreshTelemetry() {
+
+    asio::steady_timer timer(*mAsioIO);
+    std::size_t next = 0;
+
+    while(mIsConnected && !mIsCancelled) {
+
+        // client commands come first; the cache is only refreshed while the command channel is otherwise idle
+        bool idle = mQueuedCommands.empty() && mActiveCommands.empty();
+        if(mTelemetryPeriod.count() == 0 || !idle) {
+            timer.expires_after(std::chrono::milliseconds(50));
+            co_await timer.async_wait(asio::as_tuple(asio::use_awaitable));
+            continue;
+        }
+
+        auto cmd = TELEMETRY_COMMANDS[next];
+        auto reply = co_await execute(cmd, {}, DEFAULT_DEADLINE);
+        if(!mIsConnected || mIsCancelled)
+            co_return;
+
+        if(reply && !reply->error && reply->data.size() == 1)
+            mTelemetry[cmd] = {reply->data[0], std::chrono::steady_clock::now()};
+
+        if(++next == TELEMETRY_COMMANDS.size()) {
+            next = 0;
+            timer.expires_after(mTelemetryPeriod);
+            co_await timer.async_wait(asio::as_tuple(asio::use_awaitable));
+        }
+
+    }
+
+}
+
+asio::awaitable<std::optional<TimepixConnectionManager::Reply>> TimepixConnectionManager::execute(TpxCommand cmd, DataVec data, std::chrono::milliseconds deadline) {
+
+    auto pending = std::make_shared<PendingReply>(cmd, data, *mAsioIO);
+    pending->signal.expires_after(deadline);
+    mPendingReplies.push_back(pending);
+
+    sendCommand(cmd, data);
+
+    // both the deadline and the reply complete the wait; only the reply says which came first
+    co_await pending->signal.async_wait(asio::as_tuple(asio::use_awaitable));
+
+    if(!pending->reply) {
+        // the reply is no longer wanted, but it keeps its place in the queue, so that if it turns up late it isn't
+        // taken for the reply to a later command with the same code
+        pending->abandoned = true;
+        updateRegisterCache(cmd, data, false); // whether the SET happened is unknown
+    }
+
+    co_return std::move(pending->reply);
 
-    mIsExecutingCommand = true;
+}
+
+void TimepixConnectionManager::finishCommand(ActiveCommand &command) {
+
+    command.finished = true;
+    mActiveCommands.remove_if([&command](const auto &ptr) { return ptr.get() == &command; });
+
+}
+
+bool TimepixConnectionManager::isChannelHeld() const {
+
+    return std::any_of(mActiveCommands.begin(), mActiveCommands.end(), [](const auto &ptr) {
+        return ptr->info.job != CommandJob::TPX_COMMAND;
+    });
 
-    if(DEBUG_OUTPUT) {
+}
+
+void TimepixConnectionManager::sendCommand(TpxCommand cmd, const DataVec &data, bool noreply) {
+
+    if(mIsCancelled)
+        return;
+
+    if(noreply)
+        cmd = static_cast<TpxCommand>( static_cast<uint32_t>(cmd) | static_cast<uint32_t>(TpxCommand::CMD_NOREPLY) );
+
+    auto message = buildMessage(cmd, data);
+    std::size_t byte_size = message.size() * sizeof(std::uint32_t);
+
+    if(DEBUG_OUTPUT && !noreply) { // streamed no-reply commands, such as pixel matrix columns, would flood the log
         std::stringstream ss;
-        //ss << "Sending command; (" << byte_size << " bytes)";
         ss << "Sending command (" << byte_size << " bytes):\n\t";
-        for(auto ix = 0; ix < byte_size; ++ix) {
+        for(std::size_t ix = 0; ix < byte_size; ++ix) {
             ss << std::hex << std::setfill('0') << std::setw(2) << static_cast<unsigned>(reinterpret_cast<std::uint8_t*>(message.data())[ix]);
             if(ix != byte_size - 1)
                 ss << ", ";
@@ -261,7 +800,19 @@ void TimepixConnectionManager::sendCommand(TpxCommand cmd, const DataVec &data,
         DEBUG(ss.str());
     }
 
-    mTpxSocket->async_send(asio::buffer(mCommandBuffer.data(), byte_size), [this](const asio::error_code &err, std::size_t bytes) {
+    mWriteQueue.push_back(std::move(message));
+    startNextWrite();
+
+}
+
+void TimepixConnectionManager::startNextWrite() {
+
+    if(mIsWriting || mWriteQueue.empty())
+        return;
+
+    // one write at a time, so that commands can't interleave on the socket
+    mIsWriting = true;
+    asio::async_write(*mTpxSocket, asio::buffer(mWriteQueue.front()), [this](const asio::error_code &err, std::size_t bytes) {
         DEBUG("\tCommand sent");
 
         commandSent(err, bytes);
@@ -274,27 +825,71 @@ void TimepixConnectionManager::commandSent(const asio::error_code &err, std::siz
     if(mIsCancelled)
         return;
 
-    // queue up a socket read for the response
-    mTpxSocket->async_read_some(asio::buffer(mResponseBuffer), [this](const asio::error_code &err, std::size_t bytes_received) {
-        commandRecv(err, bytes_received);
+    if(err)
+        throw asio::system_error(err);
+
+    mWriteQueue.pop_front();
+    mIsWriting = false;
+    startNextWrite();
+
+}
+
+void TimepixConnectionManager::startReading() {
+
+    mTpxSocket->async_read_some(asio::buffer(mReadChunk), [this](const asio::error_code &err, std::size_t bytes_received) {
+        dataRecv(err, bytes_received);
     });
 
 }
 
-void TimepixConnectionManager::commandRecv(const asio::error_code &err, std::size_t bytes_received) {
+void TimepixConnectionManager::dataRecv(const asio::error_code &err, std::size_t bytes_received) {
 
-    if(mIsCancelled)
+    if(mIsCancelled || err == asio::error::operation_aborted)
         return;
 
-    if(err && !mIsCancelled)
+    if(err)
         throw asio::system_error(err);
 
-    if(bytes_received < 20 || bytes_received % 4) {
-        mThread.sendErr("Received an incomplete packet (" + std::to_string(bytes_received) + " bytes)");
-        return;
+    // a reply can be split across reads, and one read can hold several replies
+    mRecvBuffer.insert(mRecvBuffer.end(), mReadChunk.begin(), mReadChunk.begin() + bytes_received);
+    processFrames();
+
+    if(mIsConnected)
+        startReading();
+
+}
+
+void TimepixConnectionManager::processFrames() {
+
+    std::size_t pos = 0;
+
+    while(mRecvBuffer.size() - pos >= REPLY_HEADER_BYTES) {
+
+        auto num_bytes = io::ntohl(*reinterpret_cast<std::uint32_t*>(&mRecvBuffer[pos + 4]));
+
+        if(num_bytes < REPLY_HEADER_BYTES || num_bytes % 4 || num_bytes > MAX_REPLY_BYTES) {
+            // there is no way to find the start of the next reply, so nothing in flight can be matched any more
+            mThread.sendErr("Received a reply with an invalid length (" + std::to_string(num_bytes) + " bytes)");
+            mRecvBuffer.clear();
+            cancelPendingReplies(); // the waiting commands retry or fail straight away
+            return;
+        }
+
+        if(mRecvBuffer.size() - pos < num_bytes)
+            break; // the rest of this reply hasn't arrived yet
+
+        processReply(&mRecvBuffer[pos], num_bytes);
+        pos += num_bytes;
+
     }
 
-    auto cmd_int = io::ntohl(*reinterpret_cast<std::uint32_t*>(&mResponseBuffer[0]));
+    mRecvBuffer.erase(mRecvBuffer.begin(), mRecvBuffer.begin() + pos);
+
+}
+
+void TimepixConnectionManager::processReply(std::uint8_t *frame, std::size_t num_bytes) {
+
+    auto cmd_int = io::ntohl(*reinterpret_cast<std::uint32_t*>(&frame[0]));
     if(!(cmd_int & static_cast<std::uint32_t>(TpxCommand::CMD_REPLY))) {
         mThread.sendErr("Received a packet without the REPLY bit set");
         return;
@@ -303,9 +898,8 @@ void TimepixConnectionManager::commandRecv(const asio::error_code &err, std::siz
     auto cmd_only_int = cmd_int ^ static_cast<std::uint32_t>(TpxCommand::CMD_REPLY);
     auto cmd = static_cast<TpxCommand>(cmd_only_int);
 
-    auto num_bytes = io::ntohl(*reinterpret_cast<std::uint32_t*>(&mResponseBuffer[4]));
-    auto error_int = io::ntohl(*reinterpret_cast<std::uint32_t*>(&mResponseBuffer[8]));
-    auto chip_num = io::ntohl(*reinterpret_cast<std::uint32_t*>(&mResponseBuffer[12]));
+    auto error_int = io::ntohl(*reinterpret_cast<std::uint32_t*>(&frame[8]));
+    auto chip_num = io::ntohl(*reinterpret_cast<std::uint32_t*>(&frame[12]));
 
     if(error_int) {
         std::stringstream ss;
@@ -317,86 +911,112 @@ void TimepixConnectionManager::commandRecv(const asio::error_code &err, std::siz
         mThread.sendErr("Timepix reported an error code (command=0x" + command_str + ", error=0x" + error_str + " [" + getErrorString(error_int) + "])");
     }
 
-    if(DEBUG_OUTPUT) {
-        std::stringstream ss;
-        ss << "Received response:\n\t";
-        for(auto ix = 0; ix < bytes_received; ++ix) {
-            ss << std::hex << std::setfill('0') << std::setw(2) << static_cast<unsigned>(mResponseBuffer[ix]);
-            if(ix != bytes_received - 1)
-                ss << ", ";
-        }
-        std::cout << ss.str() << std::endl;
-    }
-
     if(chip_num) {
         mThread.sendErr("Chip number in response was not zero (value=" + std::to_string(chip_num) + ")");
         return;
     }
 
-    if(bytes_received < num_bytes) {
-        mThread.sendErr("Timepix sent " + std::to_string(num_bytes) + " bytes, only received " + std::to_string(bytes_received) + " bytes");
+    // replies come back in the order the commands were sent, so an abandoned command whose reply is overtaken by a
+    // later command's is never going to get one
+    while(!mPendingReplies.empty() && mPendingReplies.front()->abandoned && mPendingReplies.front()->command != cmd)
+        mPendingReplies.pop_front();
+
+    if(mPendingReplies.empty() || mPendingReplies.front()->command != cmd) {
+        mThread.sendWarn("Discarding an unexpected reply from the Timepix (command=" + std::to_string(cmd_only_int) + ")");
         return;
     }
 
-    auto data_bytes = num_bytes - 16;
+    auto data_bytes = num_bytes - REPLY_HEADER_BYTES;
     auto data_size = data_bytes / sizeof(std::uint32_t);
 
     DataVec data;
     data.reserve(data_size);
 
-    auto data_ptr = reinterpret_cast<std::uint32_t*>(mResponseBuffer.data()) + 4;
+    auto data_ptr = reinterpret_cast<std::uint32_t*>(frame) + 4;
 
-    for(auto i = 0; i < data_size; ++i) {
+    for(std::size_t i = 0; i < data_size; ++i) {
         auto val = io::ntohl(data_ptr[i]);
         data.push_back(val);
     }
 
-    processRecv(cmd, std::move(data));
+    auto pending = std::move(mPendingReplies.front());
+    mPendingReplies.pop_front();
+    updateRegisterCache(cmd, pending->request, !error_int); // a late reply still says whether the SET happened
+    if(pending->abandoned)
+        return;
+
+    pending->reply = Reply{std::move(data), error_int};
+    pending->signal.cancel(); // wakes the waiting command
 
 }
 
-void TimepixConnectionManager::processRecv(TpxCommand cmd, const DataVec data) {
+void TimepixConnectionManager::processRecv(const TimepixCommandInfo &info, const Reply &reply) {
 
     if(mIsCancelled)
         return;
 
-    if(!mLastCommandSource)
-        throw std::runtime_error("Received response, and there is no client!");
+    // other clients may have been served since the command was sent
+    mLastCommandSource = info.sender;
+    mLastRequest = &info.data;
+    mLastReplyError = reply.error;
+    mLastCommandSource->selectClient(info.client, info.reply_code);
 
-    if(!HANDLER_MAP.contains(cmd)) {
-        mThread.sendWarn("Did not recognise response from Timepix: " + std::to_string(static_cast<std::uint32_t>(cmd)));
+    if(!HANDLER_MAP.contains(info.command)) {
+        mThread.sendWarn("Did not recognise response from Timepix: " + std::to_string(static_cast<std::uint32_t>(info.command)));
     } else {
-        auto f = HANDLER_MAP.at(cmd);
-        ((*this).*f)(data);
+        auto f = HANDLER_MAP.at(info.command);
+        ((*this).*f)(reply.data);
     }
 
-    mQueuedCommands.pop_front(); // we no longer need to execute this command
-    mIsExecutingCommand = false;
     mLastCommandSource = nullptr;
+    mLastRequest = nullptr;
+    mLastReplyError = 0;
+
+}
+
+void TimepixConnectionManager::failActiveCommands(ServerCommand errcode) {
+
+    // the coroutines may never resume (the io_context is destroyed with the connection), so answer the clients here
+    auto commands = std::move(mActiveCommands);
+    mActiveCommands.clear();
+
+    for(auto &command : commands) {
+        command->finished = true;
+        command->info.sender->selectClient(command->info.client, command->info.reply_code);
+        command->info.sender->sendError(errcode);
+    }
+
+    cancelPendingReplies();
+
+}
+
+void TimepixConnectionManager::cancelPendingReplies() {
+
+    for(auto &pending : mPendingReplies)
+        pending->signal.cancel();
+    mPendingReplies.clear();
 
 }
 
 std::deque<TimepixCommandInfo> TimepixConnectionManager::getCommandQueue() {
 
-    return mQueuedCommands;
+    // commands still being executed haven't been answered, so they count as queued
+    auto queue = mQueuedCommands;
+    for(auto it = mActiveCommands.rbegin(); it != mActiveCommands.rend(); ++it)
+        queue.push_front((*it)->info);
+    return queue;
 
 }
 
 void TimepixConnectionManager::clearAnyClientRequest() {
 
-    if(mLastCommandSource) {
-        mLastCommandSource->sendError(ServerCommand::ERROR_OCCURED);
-        mLastCommandSource = nullptr;
-    }
+    failActiveCommands(ServerCommand::ERROR_OCCURED);
 
 }
 
 void TimepixConnectionManager::sendServerResetNotice() {
 
-    if(mLastCommandSource) {
-        mLastCommandSource->sendError(ServerCommand::SERVER_RESET);
-        mLastCommandSource = nullptr;
-    }
+    failActiveCommands(ServerCommand::SERVER_RESET);
 
 }
 
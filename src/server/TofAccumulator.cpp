@@ -0,0 +1,123 @@
+#include "server/TofAccumulator.h"
+
+#include <algorithm>
+#include <bit>
+
+constexpr std::size_t BIN_BLOCK = 4096;
+constexpr std::uint64_t TOA_MASK = 0x3FFFFFFFFF;
+
+bool TofSettings::fromConfigWords(const std::uint32_t *words, std::size_t num_words) {
+
+    if(num_words != 6 && num_words != 10)
+        return false;
+
+    period = words[0] | (static_cast<std::uint64_t>(words[1]) << 32);
+    offset = words[2] | (static_cast<std::uint64_t>(words[3]) << 32);
+    bin_width = words[4];
+    num_bins = words[5];
+
+    x0 = 0;
+    y0 = 0;
+    x1 = 256;
+    y1 = 256;
+    if(num_words == 10) {
+        x0 = words[6];
+        y0 = words[7];
+        x1 = words[8];
+        y1 = words[9];
+    }
+
+    if(num_bins == 0) // disabling the spectrum needs no other valid settings
+        return true;
+
+    return period != 0 && bin_width != 0 && num_bins <= MAX_BINS
+        && x0 < x1 && x1 <= 256 && y0 < y1 && y1 <= 256;
+
+}
+
+void TofAccumulator::setSettings(const TofSettings &settings) {
+
+    mSettings = settings;
+
+    if(settings.isEnabled()) {
+        // shifting the offset forward by whole periods keeps ToA + shift positive, so the phase needs no branch
+        mShift = (settings.period - settings.offset % settings.period) % settings.period;
+        mPeriodMask = settings.period - 1;
+        mWidthShift = std::countr_zero(settings.bin_width);
+    }
+
+    mCounts.assign(settings.isEnabled() ? settings.num_bins + 1 : 0, 0);
+    mBins.resize(BIN_BLOCK);
+
+}
+
+const TofSettings& TofAccumulator::getSettings() const {
+
+    return mSettings;
+
+}
+
+void TofAccumulator::addPackets(const std::uint64_t *data, std::size_t num_packets) {
+
+    if(!mSettings.isEnabled())
+        return;
+
+    bool pow2_period = std::has_single_bit(mSettings.period);
+    bool pow2_width = std::has_single_bit(mSettings.bin_width);
+
+    // the bins are computed for a block of hits in a branch-free loop, with every rejected hit sent to the overflow
+    // bin, and only then counted; this keeps the arithmetic vectorisable and out of the dependency on the counters
+    for(std::size_t start = 0; start < num_packets; start += BIN_BLOCK) {
+
+        auto block = std::min(BIN_BLOCK, num_packets - start);
+
+        if(pow2_period && pow2_width)
+            computeBins<true, true>(data + start, block);
+        else if(pow2_period)
+            computeBins<true, false>(data + start, block);
+        else if(pow2_width)
+            computeBins<false, true>(data + start, block);
+        else
+            computeBins<false, false>(data + start, block);
+
+        for(std::size_t ix = 0; ix < block; ++ix)
+            ++mCounts[mBins[ix]];
+
+    }
+
+}
+
+template<bool POW2_PERIOD, bool POW2_WIDTH>
+void TofAccumulator::computeBins(const std::uint64_t *packets, std::size_t num_packets) {
+
+    const auto num_bins = mSettings.num_bins;
+    const auto x0 = mSettings.x0, x1 = mSettings.x1, y0 = mSettings.y0, y1 = mSettings.y1;
+    auto *bins = mBins.data();
+
+    for(std::size_t ix = 0; ix < num_packets; ++ix) {
+        auto packet = packets[ix];
+        std::uint32_t x = (packet >> 56) & 0xFF;
+        std::uint32_t y = (packet >> 48) & 0xFF;
+
+        auto toa = (packet & TOA_MASK) + mShift;
+        auto tof = POW2_PERIOD ? (toa & mPeriodMask) : (toa % mSettings.period);
+        auto bin = POW2_WIDTH ? (tof >> mWidthShift) : (tof / mSettings.bin_width);
+
+        bool keep = (x >= x0) & (x < x1) & (y >= y0) & (y < y1) & (bin < num_bins);
+        bins[ix] = keep ? static_cast<std::uint32_t>(bin) : num_bins;
+    }
+
+}
+
+void TofAccumulator::addTo(std::vector<std::uint64_t> &total) const {
+
+    for(std::size_t ix = 0; ix < mSettings.num_bins; ++ix)
+        total[ix] += mCounts[ix];
+
+}
+
+void TofAccumulator::clear() {
+
+    std::fill(mCounts.begin(), mCounts.end(), 0);
+
+}
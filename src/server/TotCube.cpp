@@ -0,0 +1,137 @@
+#include "server/TotCube.h"
+
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <fstream>
+#include <limits>
+
+constexpr std::size_t SAVE_BATCH = 64*1024;
+
+constexpr std::uint32_t toBigEndian(std::uint32_t x) {
+    if constexpr (std::endian::native == std::endian::big) {
+        return x;
+    } else {
+        return ((x >> 24) & 0x000000FF)
+             | ((x >>  8) & 0x0000FF00)
+             | ((x <<  8) & 0x00FF0000)
+             | ((x << 24) & 0xFF000000);
+    }
+}
+
+bool TotCube::setBins(std::uint32_t num_bins, std::uint32_t bin_width) {
+
+    if(num_bins > MAX_BINS || (num_bins != 0 && bin_width == 0))
+        return false;
+
+    mNumBins = num_bins;
+    mBinWidth = bin_width;
+
+    mCounts.clear();
+    mCounts.shrink_to_fit();
+    mCounts.resize(NUM_PIXELS * num_bins, 0);
+
+    return true;
+
+}
+
+bool TotCube::isEnabled() const {
+
+    return mNumBins != 0;
+
+}
+
+std::uint32_t TotCube::getNumBins() const {
+
+    return mNumBins;
+
+}
+
+void TotCube::computeIndices(const std::uint64_t *data, std::size_t num_packets, std::vector<std::uint32_t> &indices) const {
+
+    indices.resize(num_packets);
+    if(!isEnabled())
+        return;
+
+    const auto num_bins = mNumBins;
+    const auto bin_width = mBinWidth;
+    const auto last_bin = num_bins - 1;
+    auto *out = indices.data();
+
+    for(std::size_t ix = 0; ix < num_packets; ++ix) {
+        auto packet = data[ix];
+        auto pixel = static_cast<std::uint32_t>(((packet >> 56) & 0xFF) + ((packet >> 48) & 0xFF)*256);
+        auto tot = static_cast<std::uint32_t>((packet >> 38) & 0x3FF);
+        out[ix] = pixel*num_bins + std::min(tot / bin_width, last_bin);
+    }
+
+}
+
+void TotCube::addIndices(const std::vector<std::uint32_t> &indices) {
+
+    if(!isEnabled())
+        return;
+
+    // the workers share the cube, so each count is an atomic increment, held at the maximum if it would wrap
+    constexpr auto max_count = std::numeric_limits<std::uint32_t>::max();
+    for(auto index : indices) {
+        std::atomic_ref<std::uint32_t> count(mCounts[index]);
+        if(count.fetch_add(1, std::memory_order_relaxed) == max_count)
+            count.store(max_count, std::memory_order_relaxed);
+    }
+
+}
+
+void TotCube::clear() {
+
+    std::fill(mCounts.begin(), mCounts.end(), 0);
+
+}
+
+bool TotCube::getPixels(std::size_t first_pixel, std::size_t num_pixels, std::vector<std::uint32_t> &output) const {
+
+    if(!isEnabled() || first_pixel >= NUM_PIXELS || num_pixels > NUM_PIXELS - first_pixel || num_pixels * mNumBins > MAX_READ_WORDS)
+        return false;
+
+    auto begin = mCounts.begin() + first_pixel*mNumBins;
+    output.assign(begin, begin + num_pixels*mNumBins);
+
+    return true;
+
+}
+
+bool TotCube::save(const std::string &path) const {
+
+    if(!isEnabled())
+        return false;
+
+    std::ofstream file;
+    try {
+        file.open(path, std::ios_base::out | std::ios_base::binary);
+    } catch (...) {
+        return false;
+    }
+
+    if(!file.is_open())
+        return false;
+
+    std::vector<std::uint32_t> buffer = {
+        toBigEndian(static_cast<std::uint32_t>(NUM_PIXELS)),
+        toBigEndian(mNumBins),
+        toBigEndian(mBinWidth),
+        0
+    };
+    file.write("TOTCUBE1", 8);
+    file.write(reinterpret_cast<const char*>(buffer.data()), buffer.size() * sizeof(std::uint32_t));
+
+    for(std::size_t start = 0; start < mCounts.size(); start += SAVE_BATCH) {
+        auto end = std::min(start + SAVE_BATCH, mCounts.size());
+        buffer.resize(end - start);
+        for(std::size_t ix = start; ix < end; ++ix)
+            buffer[ix - start] = toBigEndian(mCounts[ix]);
+        file.write(reinterpret_cast<const char*>(buffer.data()), buffer.size() * sizeof(std::uint32_t));
+    }
+
+    return file.good();
+
+}
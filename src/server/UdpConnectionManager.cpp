@@ -164,57 +164,13 @@ void UdpConnectionManager::publishRawData(const std::vector<std::uint8_t> &data,
     static auto last_echo_time = std::chrono::high_resolution_clock::now();
     static int last_sec_packets = 0;
 
-    // we publish data with the following format:
-    // for each packet:
-    //      X address:  8 bits
-    //      Y address:  8 bits
-    //      ToT:       10 bits
-    //      ToA:       38 bits  ( Timepix reports 34 bits; the other 4 bits leave room for rollover detection )
-
+    // see PacketDecoder for the published format
     mTempBuffer.clear();
 
     auto packet_ptr = reinterpret_cast<const std::uint64_t*>(data.data());
     auto num_packets = size/8;
 
-    unsigned long long last_toa = 0;
-
-    for(auto ix = 0; ix < num_packets; ++ix) {
-
-        auto type = (packet_ptr[ix] & 0xF000000000000000);
-        if(type != 0xB000000000000000)
-            continue;
-
-        auto addr = (packet_ptr[ix] & 0x0FFFF00000000000) >> 44;
-        std::uint64_t x = ((addr >> 1) & 0x00FC) | (addr & 0x0003);
-        std::uint64_t y = ((addr >> 8) & 0x00FE) | ((addr >> 2) & 0x0001);
-
-        auto tot = (packet_ptr[ix] & 0x000000003FF00000) >> 20;
-
-        auto toa = (packet_ptr[ix] & 0x00000FFFC0000000) >> 30;
-        auto ftoa = ((packet_ptr[ix] & 0x00000000000F0000) >> 16) ^ 0x0F;
-        auto stime = (packet_ptr[ix] & 0x000000000000FFFF);
-
-        auto full_toa = (stime << 18) | (toa << 4) | ftoa;
-
-        constexpr auto quarter_time = (static_cast<std::uint64_t>(1)<<32);
-        constexpr auto three_quarter_time = 3*quarter_time;
-
-        if(full_toa > quarter_time && full_toa < three_quarter_time)
-            mHalfwayToRollover = true;
-
-        if(mHalfwayToRollover && (mLastToA > three_quarter_time) && (full_toa < quarter_time)) {
-            mHalfwayToRollover = false;
-            mRolloverCounter = (mRolloverCounter + 1) & 0x0F;
-        }
-
-        auto tot_toa = (tot << 38) | (static_cast<std::uint64_t>(mRolloverCounter) << 34) | full_toa;
-
-        auto parsed_packet = (x << 56) | (y << 48) | tot_toa;
-        mTempBuffer.push_back(parsed_packet);
-
-        mLastToA = full_toa;
-
-    }
+    mDecoder.decode(packet_ptr, num_packets, mTempBuffer);
 
     last_sec_packets += num_packets;
     ++mReceivedChunks;
@@ -233,6 +189,6 @@ void UdpConnectionManager::publishRawData(const std::vector<std::uint8_t> &data,
 
 void UdpConnectionManager::resetToaRolloverCounter() {
 
-    mRolloverCounter = 0;
+    mDecoder.resetRolloverCounter();
 
 }
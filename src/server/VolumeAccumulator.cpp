@@ -0,0 +1,158 @@
+#include "server/VolumeAccumulator.h"
+
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <limits>
+
+constexpr std::uint64_t TOA_MASK = 0x3FFFFFFFFF;
+
+bool VolumeSettings::fromConfigWords(const std::uint32_t *words, std::size_t num_words) {
+
+    if(num_words != 7 || !tof.fromConfigWords(words, 6))
+        return false;
+
+    xy_bin_shift = words[6];
+    if(xy_bin_shift > 3)
+        return false;
+
+    return getNumVoxels() * sizeof(std::uint32_t) <= MAX_BYTES;
+
+}
+
+void VolumeAccumulator::setSettings(const VolumeSettings &settings) {
+
+    mSettings = settings;
+
+    if(settings.tof.isEnabled()) {
+        mShift = (settings.tof.period - settings.tof.offset % settings.tof.period) % settings.tof.period;
+        mPeriodMask = settings.tof.period - 1;
+        mWidthShift = std::countr_zero(settings.tof.bin_width);
+    }
+
+    mCounts.clear();
+    mCounts.shrink_to_fit(); // the old volume may be large
+    if(settings.tof.isEnabled())
+        mCounts.resize(settings.getNumVoxels() + 1, 0);
+
+}
+
+const VolumeSettings& VolumeAccumulator::getSettings() const {
+
+    return mSettings;
+
+}
+
+void VolumeAccumulator::computeIndices(const std::uint64_t *data, std::size_t num_packets, std::vector<std::uint32_t> &indices) const {
+
+    indices.resize(num_packets);
+    if(!mSettings.tof.isEnabled())
+        return;
+
+    bool pow2_period = std::has_single_bit(mSettings.tof.period);
+    bool pow2_width = std::has_single_bit(mSettings.tof.bin_width);
+
+    if(pow2_period && pow2_width)
+        computeIndicesImpl<true, true>(data, num_packets, indices.data());
+    else if(pow2_period)
+        computeIndicesImpl<true, false>(data, num_packets, indices.data());
+    else if(pow2_width)
+        computeIndicesImpl<false, true>(data, num_packets, indices.data());
+    else
+        computeIndicesImpl<false, false>(data, num_packets, indices.data());
+
+}
+
+template<bool POW2_PERIOD, bool POW2_WIDTH>
+void VolumeAccumulator::computeIndicesImpl(const std::uint64_t *data, std::size_t num_packets, std::uint32_t *indices) const {
+
+    const auto num_bins = mSettings.tof.num_bins;
+    const auto xy_shift = mSettings.xy_bin_shift;
+    const auto width = static_cast<std::uint32_t>(mSettings.getWidth());
+    const auto overflow = static_cast<std::uint32_t>(mSettings.getNumVoxels());
+
+    for(std::size_t ix = 0; ix < num_packets; ++ix) {
+        auto packet = data[ix];
+        std::uint32_t x = ((packet >> 56) & 0xFF) >> xy_shift;
+        std::uint32_t y = ((packet >> 48) & 0xFF) >> xy_shift;
+
+        auto toa = (packet & TOA_MASK) + mShift;
+        auto tof = POW2_PERIOD ? (toa & mPeriodMask) : (toa % mSettings.tof.period);
+        auto bin = POW2_WIDTH ? (tof >> mWidthShift) : (tof / mSettings.tof.bin_width);
+
+        auto voxel = static_cast<std::uint32_t>(bin)*width*width + x + y*width;
+        indices[ix] = bin < num_bins ? voxel : overflow;
+    }
+
+}
+
+void VolumeAccumulator::addIndices(const std::vector<std::uint32_t> &indices) {
+
+    if(mCounts.empty())
+        return;
+
+    // every worker counts into the same volume; a counter that wraps past the maximum is put back to it
+    constexpr auto max_count = std::numeric_limits<std::uint32_t>::max();
+    for(auto voxel : indices) {
+        std::atomic_ref<std::uint32_t> count(mCounts[voxel]);
+        if(count.fetch_add(1, std::memory_order_relaxed) == max_count)
+            count.store(max_count, std::memory_order_relaxed);
+    }
+
+}
+
+void VolumeAccumulator::clear() {
+
+    std::fill(mCounts.begin(), mCounts.end(), 0);
+
+}
+
+bool VolumeAccumulator::getSlice(std::size_t tof_start, std::size_t tof_end, std::vector<std::uint64_t> &output) const {
+
+    if(!mSettings.tof.isEnabled() || tof_start >= tof_end || tof_end > mSettings.tof.num_bins)
+        return false;
+
+    auto plane = mSettings.getWidth() * mSettings.getWidth();
+    output.assign(plane, 0);
+
+    for(auto bin = tof_start; bin < tof_end; ++bin) {
+        const auto *src = mCounts.data() + bin*plane;
+        for(std::size_t ix = 0; ix < plane; ++ix)
+            output[ix] += src[ix];
+    }
+
+    return true;
+
+}
+
+bool VolumeAccumulator::getProjection(ProjectionAxis axis, std::vector<std::uint64_t> &output) const {
+
+    if(!mSettings.tof.isEnabled())
+        return false;
+
+    if(axis == ALONG_TOF)
+        return getSlice(0, mSettings.tof.num_bins, output);
+
+    if(axis != ALONG_X && axis != ALONG_Y)
+        return false;
+
+    auto width = mSettings.getWidth();
+    auto num_bins = mSettings.tof.num_bins;
+    output.assign(width * num_bins, 0);
+
+    for(std::size_t bin = 0; bin < num_bins; ++bin) {
+        const auto *src = mCounts.data() + bin*width*width;
+        auto *dst = output.data() + bin*width;
+        for(std::size_t y = 0; y < width; ++y) {
+            for(std::size_t x = 0; x < width; ++x) {
+                if(axis == ALONG_Y)
+                    dst[x] += src[x + y*width];
+                else
+                    dst[y] += src[x + y*width];
+            }
+        }
+    }
+
+    return true;
+
+}